@@ -1,19 +1,15 @@
 #include <cassert>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <mpi.h>
 #include <unistd.h>
+#include <vector>
 
 #include "Common.hpp"
 
-int main(int argc, char **argv) {
-  MPI::Init(argc, argv);
-  Defer _{[] { MPI::Finalize(); }};
-
-  size_t size = MPI::COMM_WORLD.Get_size();
-  size_t rank = MPI::COMM_WORLD.Get_rank();
-
-  MPILogger log{"log.txt", "Process #" + std::to_string(rank)};
-
+// One int passed once around the ring, every hop is logged
+void passOnce(MPILogger &log, size_t rank, size_t size) {
   int i = 1;
 
   if (rank == 0) { // Master routine
@@ -22,11 +18,11 @@ int main(int argc, char **argv) {
     int last = size > 1 ? size - 1 : 0;
 
     log << "Sending \"" << i << "\" to #" << next << MPILogger::endl;
-  
+
     // Need to use Send, not Ssend
     MPI::COMM_WORLD.Send(&i, 1, MPI::INT, next, 42);
     MPI::COMM_WORLD.Recv(&i, 1, MPI::INT, last, MPI::ANY_TAG);
-    
+
     log << "Received \"" << i << "\" from #" << last << MPILogger::endl;
     assert(i == size);
   } else { // Slave routine
@@ -42,4 +38,181 @@ int main(int argc, char **argv) {
 
     MPI::COMM_WORLD.Send(&i, 1, MPI::INT, next, 42);
   }
-}
\ No newline at end of file
+}
+
+// nTokens tokens of payload bytes make laps laps around the ring at once.
+// Token k is a slot with tag k and buffers 2k, 2k + 1. The other ranks
+// alternate between receiving the token from prev and sending it to next,
+// 2 * laps steps in total. Rank 0 makes laps steps, each posting the
+// receive of a lap together with its send: with -np 1 it is its own prev
+// and next, and a rendezvous send can't complete before the matching
+// receive is posted. The token is received into the other buffer of the
+// slot, which is sent on the next lap. Returns the time between the
+// barrier and the last completed operation of this rank
+double spinRing(size_t rank, size_t size, size_t laps, size_t payload,
+                size_t nTokens, std::vector<std::vector<char>> &buffers) {
+  int next = (rank + 1) % size;
+  int prev = (rank + size - 1) % size;
+  const bool root = rank == 0;
+  const size_t nSteps = root ? laps : 2 * laps;
+
+  // Requests 2k and 2k + 1 belong to slot k
+  std::vector<MPI::Request> requests(2 * nTokens, MPI::REQUEST_NULL);
+  std::vector<size_t> done(nTokens, 0);
+  std::vector<int> inFlight(nTokens, 0);
+  std::vector<size_t> current(nTokens, 0); // Buffer holding the token
+
+  auto post = [&](size_t k) {
+    char *buf = buffers[2 * k + current[k]].data();
+
+    if (root) {
+      char *other = buffers[2 * k + 1 - current[k]].data();
+      requests[2 * k] =
+          MPI::COMM_WORLD.Irecv(other, payload, MPI::BYTE, prev, k);
+      requests[2 * k + 1] =
+          MPI::COMM_WORLD.Isend(buf, payload, MPI::BYTE, next, k);
+      inFlight[k] = 2;
+      return;
+    }
+
+    if (done[k] % 2 == 0)
+      requests[2 * k] = MPI::COMM_WORLD.Irecv(buf, payload, MPI::BYTE, prev, k);
+    else
+      requests[2 * k] = MPI::COMM_WORLD.Isend(buf, payload, MPI::BYTE, next, k);
+    inFlight[k] = 1;
+  };
+
+  MPI::COMM_WORLD.Barrier();
+  double start = MPI::Wtime();
+
+  for (size_t k = 0; k < nTokens; ++k)
+    post(k);
+
+  size_t left = nTokens * nSteps * (root ? 2 : 1);
+  for (; left > 0; --left) {
+    size_t k = MPI::Request::Waitany(requests.size(), requests.data()) / 2;
+    if (--inFlight[k] != 0)
+      continue;
+
+    if (root)
+      current[k] = 1 - current[k];
+    if (++done[k] < nSteps)
+      post(k);
+  }
+
+  return MPI::Wtime() - start;
+}
+
+struct RingRecord {
+  size_t Payload;
+  size_t NTokens;
+  double Seconds;   // Slowest rank
+  double HopUs;     // Time of one hop as seen by a token, us
+  double MsgsPerS;  // Hops of all tokens per second
+  double MBPerS;    // Payload moved per second over all links
+};
+
+void writeCsv(std::ostream &out, const std::vector<RingRecord> &records) {
+  out << "payload,tokens,seconds,hop_us,msgs_per_s,mb_per_s\n";
+  for (const auto &rec : records)
+    out << rec.Payload << "," << rec.NTokens << "," << rec.Seconds << ","
+        << rec.HopUs << "," << rec.MsgsPerS << "," << rec.MBPerS << "\n";
+}
+
+int main(int argc, char **argv) try {
+  MPI::Init(argc, argv);
+  Defer _{[] { MPI::Finalize(); }};
+
+  size_t size = MPI::COMM_WORLD.Get_size();
+  size_t rank = MPI::COMM_WORLD.Get_rank();
+
+  if (argc > 5) {
+    if (rank == 0)
+      std::cout << "Usage: mpirun -np <NPROC> ./1-DutchWheel "
+                   "[LAPS [MAX_SIZE [MAX_TOKENS [out.csv]]]]\n"
+                   "  no arguments: pass one int around the ring once\n"
+                   "  LAPS:       laps of every token per measurement\n"
+                   "  MAX_SIZE:   largest payload in bytes (default 1MiB)\n"
+                   "  MAX_TOKENS: largest number of tokens in flight "
+                   "(default 16)"
+                << std::endl;
+    return 1;
+  }
+
+  MPILogger log{"log.txt", "Process #" + std::to_string(rank)};
+
+  if (argc == 1) {
+    passOnce(log, rank, size);
+    log.Flush();
+    return 0;
+  }
+
+  size_t laps = std::stoul(argv[1]);
+  size_t maxSize = argc > 2 ? std::stoul(argv[2]) : 1 << 20;
+  size_t maxTokens = argc > 3 ? std::stoul(argv[3]) : 16;
+  std::string outName = argc > 4 ? argv[4] : "";
+
+  if (laps == 0 || maxTokens == 0)
+    throw std::invalid_argument("LAPS and MAX_TOKENS should be non zero");
+
+  std::vector<std::vector<char>> buffers(2 * maxTokens,
+                                         std::vector<char>(maxSize, 1));
+  std::vector<RingRecord> records;
+
+  for (size_t payload = 1; payload <= maxSize; payload *= 4) {
+    for (size_t nTokens = 1; nTokens <= maxTokens; nTokens *= 2) {
+      // Warm-up lap: connections, registration of the buffers
+      spinRing(rank, size, 1, payload, nTokens, buffers);
+
+      double local = spinRing(rank, size, laps, payload, nTokens, buffers);
+      double seconds = 0;
+      MPI::COMM_WORLD.Reduce(&local, &seconds, 1, MPI::DOUBLE, MPI::MAX, 0);
+
+      double hops = double(laps) * size;
+      records.push_back({payload, nTokens, seconds,
+                         seconds / hops * 1e6,
+                         hops * nTokens / seconds,
+                         hops * nTokens * payload / seconds / 1e6});
+
+      // Out of the timed path, compiled out unless -DMPI_LOG_LEVEL=0
+      MPI_LOG(log, Debug) << "payload " << payload << ", " << nTokens
+                          << " tokens: " << local << "s" << MPILogger::endl;
+    }
+  }
+
+  log.Flush();
+
+  if (rank != 0)
+    return 0;
+
+  std::cout << std::setw(10) << "payload" << std::setw(8) << "tokens"
+            << std::setw(12) << "hop_us" << std::setw(14) << "msgs/s"
+            << std::setw(12) << "MB/s" << std::setw(10) << "vs K=1"
+            << std::endl;
+
+  double single = 0;
+  for (const auto &rec : records) {
+    if (rec.NTokens == 1)
+      single = rec.MsgsPerS;
+
+    std::cout << std::setw(10) << rec.Payload << std::setw(8) << rec.NTokens
+              << std::setw(12) << rec.HopUs << std::setw(14) << rec.MsgsPerS
+              << std::setw(12) << rec.MBPerS << std::setw(10)
+              << rec.MsgsPerS / single << std::endl;
+  }
+
+  if (!outName.empty()) {
+    std::ofstream out(outName);
+    writeCsv(out, records);
+    if (!out)
+      throw std::runtime_error("Failed to write " + outName);
+  }
+
+  return 0;
+} catch (std::exception &e) {
+  std::cerr << "std::exception: " << e.what() << std::endl;
+  return 1;
+} catch (MPI::Exception &e) {
+  std::cerr << "MPI::Exception: " << e.Get_error_string() << std::endl;
+  return 1;
+}
@@ -1,70 +1,330 @@
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mpi.h>
 #include <numeric>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
+#include "Affinity.hpp"
+#include "Benchmark.hpp"
 #include "Common.hpp"
+#include "Series.hpp"
 
 using IndT = unsigned long long;
 
 static constexpr IndT BigNumber = std::numeric_limits<IndT>::max() >> 32;
 
-double seriesTerm(IndT n) { return 1.0 / (n + 1); }
+double seriesTerm(IndT n) { return HarmonicTerm{}(n); }
 
 double calculateSeriesInterval(IndT offset, IndT count) {
-  double sum = 0;
-  for (IndT i = 0; i < count; ++i) {
-    sum += seriesTerm(offset + i);
+  return SumSeries(HarmonicTerm{}, offset, count);
+}
+
+// Rank's interval split into nThreads sub-blocks, summed in block order
+double calculateSeriesIntervalThreaded(IndT offset, IndT count,
+                                       size_t nThreads) {
+  if (nThreads == 1)
+    return calculateSeriesInterval(offset, count);
+
+  // Allocated by the threads, so that results are first-touched on their
+  // nodes and don't share cache lines
+  std::vector<std::unique_ptr<Padded<double>>> results(nThreads);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < nThreads; ++i) {
+    IndT begin = count * i / nThreads;
+    IndT end = count * (i + 1) / nThreads;
+    threads.emplace_back([&, i, begin, end] {
+      auto res = std::make_unique<Padded<double>>();
+      res->Value = calculateSeriesInterval(offset + begin, end - begin);
+      results[i] = std::move(res);
+    });
   }
+
+  for (auto &thread : threads)
+    thread.join();
+
+  double sum = 0;
+  for (const auto &res : results)
+    sum += res->Value;
   return sum;
 }
 
-int main(int argc, char **argv) {
-  MPI::Init(argc, argv);
+// Partials of chunks [first, last) of range, split between nThreads
+std::vector<double> calculateChunksThreaded(const ChunkedRange &range,
+                                            IndT first, IndT last,
+                                            size_t nThreads) {
+  // Every thread allocates and first-touches the block of its chunks
+  std::vector<std::vector<double>> blocks(nThreads);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < nThreads; ++i) {
+    IndT begin = first + (last - first) * i / nThreads;
+    IndT end = first + (last - first) * (i + 1) / nThreads;
+    threads.emplace_back([&, i, begin, end] {
+      std::vector<double> block(end - begin);
+      SumSeriesChunks(HarmonicTerm{}, range, begin, end, block.data());
+      blocks[i] = std::move(block);
+    });
+  }
+
+  for (auto &thread : threads)
+    thread.join();
+
+  std::vector<double> partials;
+  partials.reserve(last - first);
+  for (const auto &block : blocks)
+    partials.insert(partials.end(), block.begin(), block.end());
+  return partials;
+}
+
+// How partial sums of the ranks get to the root:
+//  - p2p:       root receives size - 1 messages and adds them up, O(P)
+//  - reduce:    MPI_Reduce, tree-based in any sane implementation
+//  - allreduce: every rank gets the total
+//  - ireduce:   non-blocking reduce, the root sums the remainder terms
+//               while it is in flight
+//  - repro:     fixed chunks of SeriesChunkSize terms, their partials are
+//               gathered and tree-reduced on the root, so the sum is
+//               bit-identical for any number of ranks and threads
+enum class ReduceMode { P2P, Reduce, Allreduce, Ireduce, Repro };
+
+ReduceMode parseMode(const std::string &str) {
+  if (str == "p2p")
+    return ReduceMode::P2P;
+  if (str == "reduce")
+    return ReduceMode::Reduce;
+  if (str == "allreduce")
+    return ReduceMode::Allreduce;
+  if (str == "ireduce")
+    return ReduceMode::Ireduce;
+  if (str == "repro")
+    return ReduceMode::Repro;
+  throw std::invalid_argument("Unknown reduce mode: " + str);
+}
+
+struct RankTiming {
+  double ComputeMs;
+  double ReduceMs;
+};
+
+void printTimings(const std::vector<RankTiming> &timings) {
+  double maxMs = 0;
+  double sumMs = 0;
+
+  for (size_t i = 0; i < timings.size(); ++i) {
+    std::cout << "Rank #" << i << ": compute " << timings[i].ComputeMs
+              << "ms, reduce " << timings[i].ReduceMs << "ms" << std::endl;
+    maxMs = std::max(maxMs, timings[i].ComputeMs);
+    sumMs += timings[i].ComputeMs;
+  }
+
+  double avgMs = sumMs / timings.size();
+  std::cout << "Compute imbalance (max / avg - 1): "
+            << (avgMs > 0 ? maxMs / avgMs - 1 : 0) << std::endl;
+}
+
+// Sum of the partials of all ranks on the root (on every rank with
+// allreduce). remStart is the first term not covered by the intervals
+double reducePartials(ReduceMode mode, double sum,
+                      const std::vector<double> &partials,
+                      const ChunkedRange &range, IndT N, IndT remStart) {
+  IndT rank = MPI::COMM_WORLD.Get_rank();
+  IndT size = MPI::COMM_WORLD.Get_size();
+  double total = 0;
+
+  switch (mode) {
+  case ReduceMode::P2P:
+    if (rank == 0) { // Master routine
+      std::vector<MPI::Request> requests(size - 1);
+      std::vector<double> data(size - 1, 0);
+
+      for (IndT i = 0; i < size - 1; ++i)
+        requests[i] = MPI::COMM_WORLD.Irecv(&data[i], 1, MPI::DOUBLE, i + 1,
+                                            MPI::ANY_TAG);
+
+      MPI::Request::Waitall(requests.size(), requests.data());
+      total = std::accumulate(data.begin(), data.end(), sum);
+
+    } else { // Slave routine
+      MPI::COMM_WORLD.Send(&sum, 1, MPI::DOUBLE, 0, 42);
+    }
+    break;
+
+  case ReduceMode::Reduce:
+    MPI::COMM_WORLD.Reduce(&sum, &total, 1, MPI::DOUBLE, MPI::SUM, 0);
+    break;
+
+  case ReduceMode::Allreduce:
+    MPI::COMM_WORLD.Allreduce(&sum, &total, 1, MPI::DOUBLE, MPI::SUM);
+    break;
+
+  case ReduceMode::Ireduce: {
+    // No Ireduce in the C++ bindings
+    MPI_Request request;
+    MPI_Ireduce(&sum, &total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD,
+                &request);
+
+    double remainder = 0;
+    if (rank == 0 && remStart <= N)
+      remainder = calculateSeriesInterval(remStart, N - remStart + 1);
+
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+    total += remainder;
+    break;
+  }
+
+  case ReduceMode::Repro: {
+    std::vector<int> counts(size), displs(size);
+    for (IndT i = 0; i < size; ++i) {
+      displs[i] = range.FirstOf(i, size);
+      counts[i] = range.FirstOf(i + 1, size) - displs[i];
+    }
+
+    std::vector<double> all(rank == 0 ? range.NChunks() : 0);
+    MPI::COMM_WORLD.Gatherv(partials.data(), partials.size(), MPI::DOUBLE,
+                            all.data(), counts.data(), displs.data(),
+                            MPI::DOUBLE, 0);
+
+    if (rank == 0)
+      total = TreeReduce(all);
+    break;
+  }
+  }
+
+  return total;
+}
+
+int main(int argc, char **argv) try {
+  // Worker threads only compute, MPI is called from the main thread
+  int provided = MPI::Init_thread(argc, argv, MPI::THREAD_FUNNELED);
   Defer _{[] { MPI::Finalize(); }};
 
+  if (provided < MPI::THREAD_FUNNELED)
+    throw std::runtime_error("MPI doesn't provide MPI_THREAD_FUNNELED");
+
+  IndT rank = MPI::COMM_WORLD.Get_rank();
+  IndT size = MPI::COMM_WORLD.Get_size();
+
+  if (argc < 2 || argc > 4) {
+    if (rank == 0)
+      std::cout << "Usage: mpirun -np <NRANKS> ./1-SeriesSum "
+                   "[NTHREADS [MODE]] <N>\n"
+                   "  NTHREADS: threads per rank (default 1)\n"
+                   "  MODE: p2p (default), reduce, allreduce, ireduce, repro\n"
+                   "  N: number of terms, 0 for the largest one"
+                << std::endl;
+    return 1;
+  }
+
   IndT N = std::stoul(argv[argc - 1]);
+  size_t nThreads = argc > 2 ? std::stoul(argv[1]) : 1;
+  ReduceMode mode = argc > 3 ? parseMode(argv[2]) : ReduceMode::P2P;
+
+  if (nThreads == 0)
+    throw std::invalid_argument("NTHREADS should be non zero");
 
   if (N == 0) N = BigNumber;
   else N--;
 
-  IndT rank = MPI::COMM_WORLD.Get_rank();
-  IndT size = MPI::COMM_WORLD.Get_size();
-
   MPILogger log{"log.txt", "Process #" + std::to_string(rank)};
 
   IndT len = N / size; // Couldn't come up with better name
   IndT start = len * rank;
 
-  double sum = calculateSeriesInterval(start, len);
-  IndT remStart = len * size;
+  ChunkedRange range{N + 1, SeriesChunkSize};
+  IndT firstChunk = range.FirstOf(rank, size);
+  IndT lastChunk = range.FirstOf(rank + 1, size);
 
-  log << "[" << start << "-" << start + len << ")";
+  Benchmark bench("1-SeriesSum", BenchmarkConfig::FromEnv());
+  bench.Param("ranks", size);
+  bench.Param("threads", nThreads);
+  bench.Param("mode", argc > 3 ? argv[2] : "p2p");
+  bench.Param("terms", N + 1);
 
-  if (remStart + rank <= N) {
-    sum += seriesTerm(remStart + rank);
-    log << ", {" << remStart + rank << "}";
-  }
+  // Phase of a repetition takes as long as its slowest rank
+  bench.SetCombine(
+      [](double ms) {
+        double max = 0;
+        MPI::COMM_WORLD.Allreduce(&ms, &max, 1, MPI::DOUBLE, MPI::MAX);
+        return max;
+      },
+      rank == 0);
+  bench.Declare("compute");
+  bench.Declare("communication");
+
+  double total = 0;
+  RankTiming self{};
 
-  log << MPILogger::endl;
+  // Region stats of every rank go to $INSTRUMENT
+  ScopedInstrumentation instrumentation("rank " + std::to_string(rank));
 
-  if (rank == 0) { // Master routine
-    std::vector<MPI::Request> requests(size - 1);
-    std::vector<double> data(size - 1, 0);
+  bench.Run([&] {
+    double computeStart = MPI::Wtime();
+    double sum = 0;
+    std::vector<double> partials;
+    IndT remStart = len * size;
 
-    for (IndT i = 0; i < size - 1; ++i)
-      requests[i] =
-          MPI::COMM_WORLD.Irecv(&data[i], 1, MPI::DOUBLE, i + 1, MPI::ANY_TAG);
+    {
+      auto _ = bench.Time("compute");
 
-    MPI::Request::Waitall(requests.size(), requests.data());
+      if (mode == ReduceMode::Repro) {
+        partials =
+            calculateChunksThreaded(range, firstChunk, lastChunk, nThreads);
+        log << "chunks [" << firstChunk << "-" << lastChunk << ")";
+      } else {
+        sum = calculateSeriesIntervalThreaded(start, len, nThreads);
+        log << "[" << start << "-" << start + len << ")";
+      }
 
-    sum = std::accumulate(data.begin(), data.end(), sum);
-    std::cout << "Sum [1, " << N + 1 << "] = " << sum << std::endl;
+      // With ireduce the root takes the whole remainder after posting the
+      // reduction, with repro there is none, otherwise every rank adds one
+      // of its terms
+      if (mode != ReduceMode::Ireduce && mode != ReduceMode::Repro &&
+          remStart + rank <= N) {
+        sum += seriesTerm(remStart + rank);
+        log << ", {" << remStart + rank << "}";
+      }
 
-  } else { // Slave routine
-    MPI::COMM_WORLD.Send(&sum, 1, MPI::DOUBLE, 0, 42);
+      log << MPILogger::endl;
+    }
+
+    double reduceStart = MPI::Wtime();
+    {
+      auto _ = bench.Time("communication");
+      total = reducePartials(mode, sum, partials, range, N, remStart);
+    }
+
+    double reduceEnd = MPI::Wtime();
+    self = {(reduceStart - computeStart) * 1000,
+            (reduceEnd - reduceStart) * 1000};
+  });
+
+  log.Flush();
+
+  std::vector<RankTiming> timings(rank == 0 ? size : 0);
+  MPI::COMM_WORLD.Gather(&self, 2, MPI::DOUBLE, timings.data(), 2,
+                         MPI::DOUBLE, 0);
+
+  if (rank == 0) {
+    printTimings(timings);
+    bench.Report();
+    bench.WriteJson();
+
+    auto ref = SumSeriesWithTail(HarmonicTerm{}, N + 1, 64);
+    std::cout << std::setprecision(17) << "Sum [1, " << N + 1
+              << "] = " << total << std::endl;
+    std::cout << "Euler-Maclaurin:   " << ref.Value << " +- " << ref.Error
+              << std::endl;
   }
 
   return 0;
-}
\ No newline at end of file
+} catch (std::exception &e) {
+  std::cerr << "std::exception: " << e.what() << std::endl;
+  return 1;
+} catch (MPI::Exception &e) {
+  std::cerr << "MPI::Exception: " << e.Get_error_string() << std::endl;
+  return 1;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <Instrumentation.hpp>
 #include <memory>
 #include <queue>
 #include <vector>
@@ -42,6 +43,10 @@ struct IMethod {
   // @brief Provides the right stride for calculation
   virtual size_t GetRStride() const = 0;
 
+  // @brief Provides the flops of one EvalNext call, the source term
+  // function excluded
+  virtual double GetFlops() const = 0;
+
   virtual ~IMethod() = default;
 };
 
@@ -94,6 +99,11 @@ public:
   // Assuming that all the value[i < start] were calculated
   // end - exclusive
   void Process(DataBufT &buf, size_t start, size_t end) {
+    // Every cell is read and written once
+    static const RegionHandle region{"LayerSolver::Process"};
+    ScopedRegion _(region, end - start, (end - start) * Method->GetFlops(),
+                   2 * (end - start) * sizeof(DataT));
+
     DataCacheT cache;
 
     if (start < Method->GetLStride())
@@ -50,6 +50,7 @@ public:
 
   size_t GetLStride() const override { return 1; };
   size_t GetRStride() const override { return 0; };
+  double GetFlops() const override { return 10; };
 };
 
 // Explicit rectangle:
@@ -89,4 +90,5 @@ public:
 
   size_t GetLStride() const override { return 1; };
   size_t GetRStride() const override { return 0; };
+  double GetFlops() const override { return 17; };
 };
\ No newline at end of file
@@ -154,6 +154,9 @@ public:
     int commSize = MPI::COMM_WORLD.Get_size();
     int selfRank = MPI::COMM_WORLD.Get_rank();
 
+    // Region stats of every rank go to $INSTRUMENT
+    ScopedInstrumentation instrumentation("rank " + std::to_string(selfRank));
+
     size_t nLayers = problem.Borders.T / problem.Steps.T;
     size_t layerSize = problem.Borders.X / problem.Steps.H;
 
@@ -0,0 +1,35 @@
+import sys
+import csv
+from collections import defaultdict
+import matplotlib.pyplot as plt
+
+# Scaling curves of 2-Collectives CSV output: p50 time over the "world"
+# communicator size, one plot per message size, one line per operation
+path = sys.argv[1]
+sizes = list(map(int, sys.argv[2:])) or None
+
+curves = defaultdict(list)
+with open(path, "r") as f:
+  for row in csv.DictReader(f):
+    if row["comm"] != "world":
+      continue
+    size = int(row["size"])
+    if sizes and size not in sizes:
+      continue
+    name = row["op"] + (" (nb)" if row["nonblocking"] == "1" else "")
+    curves[size, name].append((int(row["comm_size"]), float(row["p50_us"])))
+
+for size in sorted({size for size, _ in curves}):
+  plt.figure()
+  for (s, name), points in sorted(curves.items()):
+    if s != size:
+      continue
+    points.sort()
+    plt.plot([p[0] for p in points], [p[1] for p in points], "o-", label=name)
+  plt.xscale("log", base=2)
+  plt.yscale("log")
+  plt.xlabel("ranks")
+  plt.ylabel("p50, us")
+  plt.title(f"{size} bytes per rank")
+  plt.legend()
+  plt.savefig(f"collectives_{size}.png")
@@ -1,90 +1,351 @@
 #include "Common.hpp"
+#include "Instrumentation.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <mpi.h>
 #include <time.h>
+#include <vector>
 
-timespec GetTimespec(clockid_t cid = CLOCK_REALTIME) {
-  timespec ts = {};
-  if (clock_gettime(cid, &ts) < 0)
-    throw std::runtime_error(std::string("clock_gettime: ") + strerror(errno));
-  return ts;
+// Messages of a bandwidth sample are received into distinct buffers,
+// their total size is capped by this
+static constexpr size_t WindowBytes = 64 << 20;
+
+enum class SendMode { Send, Ssend, Isend, Persistent };
+
+const char *ModeName(SendMode mode) {
+  switch (mode) {
+  case SendMode::Send:
+    return "Send";
+  case SendMode::Ssend:
+    return "Ssend";
+  case SendMode::Isend:
+    return "Isend";
+  case SendMode::Persistent:
+    return "Persistent";
+  }
+  return "?";
 }
 
-// ts2 >= ts1
-timespec GetTimeDiff(timespec ts1, timespec ts2) {
-  timespec tsd = {};
-  if (ts1.tv_sec > ts2.tv_sec ||
-      (ts1.tv_sec == ts2.tv_sec && ts1.tv_nsec > ts2.tv_nsec))
-    throw std::runtime_error("GetTimeDiff: wrong order");
+// Sends nmsgs messages of size bytes from buf to dest in the given mode.
+// Persistent requests are created once per size and reused by every sample
+class Sender final {
+private:
+  SendMode Mode;
+  const char *Buf;
+  size_t Size;
+  int Dest;
+  std::vector<MPI::Request> Requests;
+  std::vector<MPI::Prequest> Persistent;
+
+public:
+  Sender(SendMode mode, const char *buf, size_t size, int dest, size_t nmsgs)
+      : Mode{mode}, Buf{buf}, Size{size}, Dest{dest}, Requests(nmsgs) {
+    if (mode == SendMode::Persistent)
+      for (size_t i = 0; i < nmsgs; ++i)
+        Persistent.push_back(
+            MPI::COMM_WORLD.Send_init(buf, size, MPI::BYTE, dest, 42));
+  }
 
-  tsd.tv_sec = ts2.tv_sec - ts1.tv_sec;
-  tsd.tv_nsec = ts2.tv_nsec - ts1.tv_nsec;
+  Sender(const Sender &) = delete;
+  Sender &operator=(const Sender &) = delete;
 
-  if (tsd.tv_nsec < 0) {
-    tsd.tv_sec--;
-    tsd.tv_nsec += 1000000000;
+  ~Sender() {
+    for (auto &req : Persistent)
+      req.Free();
   }
 
-  return tsd;
-}
+  void Run() {
+    switch (Mode) {
+    case SendMode::Send:
+      for (size_t i = 0; i < Requests.size(); ++i)
+        MPI::COMM_WORLD.Send(Buf, Size, MPI::BYTE, Dest, 42);
+      break;
+
+    case SendMode::Ssend:
+      for (size_t i = 0; i < Requests.size(); ++i)
+        MPI::COMM_WORLD.Ssend(Buf, Size, MPI::BYTE, Dest, 42);
+      break;
+
+    case SendMode::Isend:
+      for (auto &req : Requests)
+        req = MPI::COMM_WORLD.Isend(Buf, Size, MPI::BYTE, Dest, 42);
+      MPI::Request::Waitall(Requests.size(), Requests.data());
+      break;
+
+    case SendMode::Persistent:
+      MPI::Prequest::Startall(Persistent.size(), Persistent.data());
+      MPI::Request::Waitall(Persistent.size(), Persistent.data());
+      break;
+    }
+  }
+};
+
+// Pre-posted receives of nmsgs messages into consecutive slots of buf
+class Receiver final {
+private:
+  char *Buf;
+  size_t Size;
+  int Source;
+  std::vector<MPI::Request> Requests;
+
+public:
+  Receiver(char *buf, size_t size, int source, size_t nmsgs)
+      : Buf{buf}, Size{size}, Source{source}, Requests(nmsgs) {}
+
+  void Post() {
+    for (size_t i = 0; i < Requests.size(); ++i)
+      Requests[i] = MPI::COMM_WORLD.Irecv(Buf + i * Size, Size, MPI::BYTE,
+                                          Source, 42);
+  }
+
+  void Wait() { MPI::Request::Waitall(Requests.size(), Requests.data()); }
+};
 
-double Timespec2Ms(timespec ts) {
-  double ms = ts.tv_sec * 1000 + float(ts.tv_nsec) / (1000 * 1000);
-  return ms;
+struct Stats {
+  double Min, P50, P99, Max, Mean;
+};
+
+// Nearest-rank percentiles
+Stats ComputeStats(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+
+  auto percentile = [&](double q) {
+    size_t rank = std::max<size_t>(1, size_t(std::ceil(q * n)));
+    return samples[std::min(rank, n) - 1];
+  };
+
+  double sum = 0;
+  for (double val : samples)
+    sum += val;
+
+  return {samples.front(), percentile(0.5), percentile(0.99), samples.back(),
+          sum / n};
 }
 
-void TxRoutine(double &timeval, MPILogger &log, size_t nsends) {
-  for (size_t i = 0; i < nsends; ++i) {
+struct Record {
+  std::string Test;
+  SendMode Mode;
+  size_t Size;
+  size_t Window;
+  Stats Us;           // Per sample
+  double BandwidthMBs; // From the median sample
+};
+
+struct BenchConfig {
+  size_t NReps;
+  size_t NWarmup;
+  size_t MaxWindow;
+};
+
+// NWarmup untimed runs of sample, then NReps timed ones in microseconds
+template <typename F>
+std::vector<double> Measure(const BenchConfig &config, F &&sample) {
+  std::vector<double> us;
+  us.reserve(config.NReps);
+
+  for (size_t i = 0; i < config.NWarmup + config.NReps; ++i) {
+    MPI::COMM_WORLD.Barrier();
     auto start = GetTimespec();
-    int dummy = 0;
-    MPI::COMM_WORLD.Send(&dummy, 1, MPI::INT, 1, 42);
+    sample();
     auto end = GetTimespec();
 
-    auto timems = Timespec2Ms(GetTimeDiff(start, end));
-    //log << timems << MPILogger::endl;
-
-    timeval += timems;
+    if (i >= config.NWarmup)
+      us.push_back(Timespec2Ms(GetTimeDiff(start, end)) * 1000);
   }
+
+  return us;
+}
+
+// Half of the round trip of a single message
+Record PingPong(const BenchConfig &config, SendMode mode, size_t size,
+                std::vector<char> &sendBuf, std::vector<char> &recvBuf) {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  int peer = 1 - rank;
+
+  Sender sender(mode, sendBuf.data(), size, peer, 1);
+
+  auto us = Measure(config, [&] {
+    if (rank == 0) {
+      sender.Run();
+      MPI::COMM_WORLD.Recv(recvBuf.data(), size, MPI::BYTE, peer, 42);
+    } else {
+      MPI::COMM_WORLD.Recv(recvBuf.data(), size, MPI::BYTE, peer, 42);
+      sender.Run();
+    }
+  });
+
+  for (auto &val : us)
+    val /= 2;
+
+  Stats stats = ComputeStats(us);
+  return {"pingpong", mode, size, 1, stats, size / stats.P50};
 }
 
-void RxRoutine(size_t nsends) {
-  for (size_t i = 0; i < nsends; ++i) {
-    int dummy = 0;
-    MPI::COMM_WORLD.Recv(&dummy, 1, MPI::INT, 0, MPI::ANY_TAG);
+// Rank 0 streams a window of messages, rank 1 acknowledges the whole window
+Record Unidirectional(const BenchConfig &config, SendMode mode, size_t size,
+                      std::vector<char> &sendBuf, std::vector<char> &recvBuf) {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  size_t window = std::clamp<size_t>(WindowBytes / std::max<size_t>(size, 1),
+                                     1, config.MaxWindow);
+
+  Sender sender(mode, sendBuf.data(), size, 1, rank == 0 ? window : 0);
+  Receiver receiver(recvBuf.data(), size, 0, rank == 1 ? window : 0);
+  char ack = 0;
+
+  auto us = Measure(config, [&] {
+    if (rank == 0) {
+      sender.Run();
+      MPI::COMM_WORLD.Recv(&ack, 1, MPI::BYTE, 1, 43);
+    } else {
+      receiver.Post();
+      receiver.Wait();
+      MPI::COMM_WORLD.Send(&ack, 1, MPI::BYTE, 0, 43);
+    }
+  });
+
+  Stats stats = ComputeStats(us);
+  return {"unidir", mode, size, window, stats, window * size / stats.P50};
+}
+
+// Both ranks stream a window to each other, receives are pre-posted so
+// that blocking sends don't deadlock
+Record Bidirectional(const BenchConfig &config, SendMode mode, size_t size,
+                     std::vector<char> &sendBuf, std::vector<char> &recvBuf) {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  int peer = 1 - rank;
+  size_t window = std::clamp<size_t>(WindowBytes / std::max<size_t>(size, 1),
+                                     1, config.MaxWindow);
+
+  Sender sender(mode, sendBuf.data(), size, peer, window);
+  Receiver receiver(recvBuf.data(), size, peer, window);
+
+  auto us = Measure(config, [&] {
+    receiver.Post();
+    sender.Run();
+    receiver.Wait();
+  });
+
+  Stats stats = ComputeStats(us);
+  return {"bidir", mode, size, window, stats, 2 * window * size / stats.P50};
+}
+
+void WriteCsv(std::ostream &out, const std::vector<Record> &records) {
+  out << "test,mode,size,window,min_us,p50_us,p99_us,max_us,mean_us,"
+         "bandwidth_MBs\n";
+  for (const auto &rec : records)
+    out << rec.Test << "," << ModeName(rec.Mode) << "," << rec.Size << ","
+        << rec.Window << "," << rec.Us.Min << "," << rec.Us.P50 << ","
+        << rec.Us.P99 << "," << rec.Us.Max << "," << rec.Us.Mean << ","
+        << rec.BandwidthMBs << "\n";
+}
+
+void WriteJson(std::ostream &out, const std::vector<Record> &records) {
+  out << "[\n";
+  for (size_t i = 0; i < records.size(); ++i) {
+    const auto &rec = records[i];
+    out << "  {\"test\": \"" << rec.Test << "\", \"mode\": \""
+        << ModeName(rec.Mode) << "\", \"size\": " << rec.Size
+        << ", \"window\": " << rec.Window << ", \"min_us\": " << rec.Us.Min
+        << ", \"p50_us\": " << rec.Us.P50 << ", \"p99_us\": " << rec.Us.P99
+        << ", \"max_us\": " << rec.Us.Max << ", \"mean_us\": " << rec.Us.Mean
+        << ", \"bandwidth_MBs\": " << rec.BandwidthMBs << "}"
+        << (i + 1 < records.size() ? ",\n" : "\n");
   }
+  out << "]\n";
 }
 
 int main(int argc, char *argv[]) try {
   MPI::Init(argc, argv);
   Defer _([] { MPI::Finalize(); });
 
-  MPILogger log("log.txt", "Master");
-
-  size_t nreps = std::stoul(argv[argc - 2]);
-  size_t nsends = std::stoul(argv[argc - 1]);
-
   const int csize = MPI::COMM_WORLD.Get_size();
   const int crank = MPI::COMM_WORLD.Get_rank();
 
+  if (argc < 3 || argc > 5) {
+    if (crank == 0)
+      std::cout << "Usage: mpirun -np 2 ./2-Admission <nreps> <nsends> "
+                   "[max_size] [out.csv|out.json]\n"
+                   "  nreps:    timed samples per test and size, plus 10% "
+                   "of warm-up\n"
+                   "  nsends:   max messages in a bandwidth window\n"
+                   "  max_size: largest message in bytes (default 64MiB)"
+                << std::endl;
+    return 1;
+  }
+
   if (csize != 2)
     throw std::runtime_error("NP should be equal to 2");
 
-  double time = 0;
+  MPILogger log("log.txt", "Process #" + std::to_string(crank));
 
-  for (size_t i = 0; i < nreps; ++i) {
-    if (crank == 0)
-      TxRoutine(time, log, nsends);
-    if (crank == 1)
-      RxRoutine(nsends);
+  BenchConfig config;
+  config.NReps = std::stoul(argv[1]);
+  config.NWarmup = std::max<size_t>(1, config.NReps / 10);
+  config.MaxWindow = std::max<size_t>(1, std::stoul(argv[2]));
+
+  size_t maxSize = argc > 3 ? std::stoul(argv[3]) : 64 << 20;
+  std::string outName = argc > 4 ? argv[4] : "";
+
+  if (config.NReps == 0)
+    throw std::runtime_error("nreps should be non zero");
+
+  std::vector<char> sendBuf(maxSize, 1);
+  std::vector<char> recvBuf(std::max(maxSize, WindowBytes));
+  std::vector<Record> records;
+
+  const SendMode modes[] = {SendMode::Send, SendMode::Ssend, SendMode::Isend,
+                            SendMode::Persistent};
+
+  for (size_t size = 1; size <= maxSize; size *= 2) {
+    for (SendMode mode : modes) {
+      records.push_back(PingPong(config, mode, size, sendBuf, recvBuf));
+      records.push_back(Unidirectional(config, mode, size, sendBuf, recvBuf));
+      records.push_back(Bidirectional(config, mode, size, sendBuf, recvBuf));
+    }
+
+    // Out of the timed path
+    log << "Done with " << size << " bytes" << MPILogger::endl;
   }
 
-  if (crank == 1)
+  log.Flush();
+
+  if (crank != 0)
     return 0;
 
-  std::cout << "Avg wall time for Send: " << 1000 * time / (nreps * nsends) << "us" << std::endl;
+  std::cout << std::left << std::setw(10) << "test" << std::setw(12) << "mode"
+            << std::right << std::setw(10) << "size" << std::setw(12) << "p50us"
+            << std::setw(12) << "p99us" << std::setw(12) << "maxus"
+            << std::setw(14) << "MB/s" << std::endl;
+
+  for (const auto &rec : records)
+    std::cout << std::left << std::setw(10) << rec.Test << std::setw(12)
+              << ModeName(rec.Mode) << std::right << std::setw(10) << rec.Size
+              << std::setw(12) << rec.Us.P50 << std::setw(12) << rec.Us.P99
+              << std::setw(12) << rec.Us.Max << std::setw(14)
+              << rec.BandwidthMBs << std::endl;
+
+  if (!outName.empty()) {
+    std::ofstream out(outName);
+    bool json = outName.size() >= 5 &&
+                outName.compare(outName.size() - 5, 5, ".json") == 0;
+    if (json)
+      WriteJson(out, records);
+    else
+      WriteCsv(out, records);
+
+    if (!out)
+      throw std::runtime_error("Failed to write " + outName);
+  }
 
   return 0;
 } catch (std::exception &e) {
   std::cerr << "std::exception: " << e.what() << std::endl;
+  return 1;
 } catch (MPI::Exception &e) {
   std::cerr << "MPI::Exception: " << e.Get_error_string() << std::endl;
-}
\ No newline at end of file
+  return 1;
+}
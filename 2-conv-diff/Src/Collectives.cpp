@@ -0,0 +1,339 @@
+#include "Common.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <mpi.h>
+#include <vector>
+
+enum class Collective { Bcast, Reduce, Allreduce, Allgather, Alltoall };
+
+const char *CollectiveName(Collective op) {
+  switch (op) {
+  case Collective::Bcast:
+    return "Bcast";
+  case Collective::Reduce:
+    return "Reduce";
+  case Collective::Allreduce:
+    return "Allreduce";
+  case Collective::Allgather:
+    return "Allgather";
+  case Collective::Alltoall:
+    return "Alltoall";
+  }
+  return "?";
+}
+
+// Sub-communicator under test, Kind is one of:
+//  - world:  the first Size ranks of COMM_WORLD
+//  - node0:  ranks sharing the node with rank 0, other nodes aren't measured
+//  - leader: one rank per node
+struct Subcomm {
+  std::string Kind;
+  MPI::Intracomm Comm;
+  int Size;
+};
+
+// Buffers for size bytes per rank (per peer for Allgather/Alltoall)
+struct Buffers {
+  std::vector<char> Send;
+  std::vector<char> Recv;
+};
+
+// Reduce and Allreduce run over doubles, so they need size of at least one
+// double (see IsMeasured), the rest run over bytes. Non-blocking variants
+// go through the C API: there are none in the C++ bindings
+void RunCollective(Collective op, bool nonblocking, const MPI::Intracomm &comm,
+                   size_t size, Buffers &buf) {
+  MPI_Comm ccomm = comm;
+  int count = size;
+  int ndoubles = size / sizeof(double);
+  void *send = buf.Send.data();
+  void *recv = buf.Recv.data();
+
+  if (!nonblocking) {
+    switch (op) {
+    case Collective::Bcast:
+      comm.Bcast(send, count, MPI::BYTE, 0);
+      break;
+    case Collective::Reduce:
+      comm.Reduce(send, recv, ndoubles, MPI::DOUBLE, MPI::SUM, 0);
+      break;
+    case Collective::Allreduce:
+      comm.Allreduce(send, recv, ndoubles, MPI::DOUBLE, MPI::SUM);
+      break;
+    case Collective::Allgather:
+      comm.Allgather(send, count, MPI::BYTE, recv, count, MPI::BYTE);
+      break;
+    case Collective::Alltoall:
+      comm.Alltoall(send, count, MPI::BYTE, recv, count, MPI::BYTE);
+      break;
+    }
+    return;
+  }
+
+  MPI_Request req;
+  switch (op) {
+  case Collective::Bcast:
+    MPI_Ibcast(send, count, MPI_BYTE, 0, ccomm, &req);
+    break;
+  case Collective::Reduce:
+    MPI_Ireduce(send, recv, ndoubles, MPI_DOUBLE, MPI_SUM, 0, ccomm, &req);
+    break;
+  case Collective::Allreduce:
+    MPI_Iallreduce(send, recv, ndoubles, MPI_DOUBLE, MPI_SUM, ccomm, &req);
+    break;
+  case Collective::Allgather:
+    MPI_Iallgather(send, count, MPI_BYTE, recv, count, MPI_BYTE, ccomm, &req);
+    break;
+  case Collective::Alltoall:
+    MPI_Ialltoall(send, count, MPI_BYTE, recv, count, MPI_BYTE, ccomm, &req);
+    break;
+  }
+  MPI_Wait(&req, MPI_STATUS_IGNORE);
+}
+
+// Smaller reductions would move a whole double and be recorded under the
+// wrong size
+bool IsMeasured(Collective op, size_t size) {
+  bool reduction = op == Collective::Reduce || op == Collective::Allreduce;
+  return !reduction || size >= sizeof(double);
+}
+
+struct Stats {
+  double P50, P99, Max, Mean;
+};
+
+// Nearest-rank percentiles
+Stats ComputeStats(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+
+  auto percentile = [&](double q) {
+    size_t rank = std::max<size_t>(1, size_t(std::ceil(q * n)));
+    return samples[std::min(rank, n) - 1];
+  };
+
+  double sum = 0;
+  for (double val : samples)
+    sum += val;
+
+  return {percentile(0.5), percentile(0.99), samples.back(), sum / n};
+}
+
+struct Record {
+  Collective Op;
+  bool Nonblocking;
+  std::string Kind;
+  int CommSize;
+  size_t Size;
+  Stats Us;
+};
+
+// Sample i is the slowest rank's time of the i-th call, every sample
+// starts from a barrier. Valid on the root of comm
+Stats Measure(Collective op, bool nonblocking, const MPI::Intracomm &comm,
+              size_t size, Buffers &buf, size_t nreps, size_t nwarmup) {
+  std::vector<double> us;
+  us.reserve(nreps);
+
+  for (size_t i = 0; i < nwarmup + nreps; ++i) {
+    comm.Barrier();
+    double start = MPI::Wtime();
+    RunCollective(op, nonblocking, comm, size, buf);
+    double end = MPI::Wtime();
+
+    if (i >= nwarmup)
+      us.push_back((end - start) * 1e6);
+  }
+
+  std::vector<double> slowest(nreps);
+  comm.Reduce(us.data(), slowest.data(), nreps, MPI::DOUBLE, MPI::MAX, 0);
+
+  return comm.Get_rank() == 0 ? ComputeStats(slowest) : Stats{};
+}
+
+// Sub-communicators with at least 2 ranks, rank 0 of COMM_WORLD is rank 0
+// in all of them. Ranks outside a communicator get COMM_NULL
+std::vector<Subcomm> MakeSubcomms() {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  int size = MPI::COMM_WORLD.Get_size();
+  std::vector<Subcomm> comms;
+
+  // Powers of two and the whole world: the scaling curve
+  std::vector<int> sizes;
+  for (int k = 2; k < size; k *= 2)
+    sizes.push_back(k);
+  if (size > 1)
+    sizes.push_back(size);
+
+  for (int k : sizes) {
+    auto comm = MPI::COMM_WORLD.Split(rank < k ? 0 : MPI::UNDEFINED, rank);
+    comms.push_back({"world", comm, k});
+  }
+
+  MPI_Comm cnode;
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                      MPI_INFO_NULL, &cnode);
+  MPI::Intracomm node(cnode);
+
+  int nodeRank = node.Get_rank();
+  int nodeSize = node.Get_size();
+
+  // Node of rank 0 only, so that rank 0 sees all results
+  int onRootNode = 0;
+  if (rank == 0)
+    onRootNode = 1;
+  node.Bcast(&onRootNode, 1, MPI::INT, 0);
+
+  auto rootNode = MPI::COMM_WORLD.Split(onRootNode ? 0 : MPI::UNDEFINED, rank);
+  auto leaders = MPI::COMM_WORLD.Split(nodeRank == 0 ? 0 : MPI::UNDEFINED, rank);
+  node.Free();
+
+  int nLeaders = 0;
+  int isLeader = nodeRank == 0;
+  MPI::COMM_WORLD.Allreduce(&isLeader, &nLeaders, 1, MPI::INT, MPI::SUM);
+
+  int rootNodeSize = nodeSize;
+  MPI::COMM_WORLD.Bcast(&rootNodeSize, 1, MPI::INT, 0);
+
+  if (rootNodeSize > 1)
+    comms.push_back({"node0", rootNode, rootNodeSize});
+  else if (rootNode != MPI::COMM_NULL)
+    rootNode.Free();
+
+  if (nLeaders > 1)
+    comms.push_back({"leader", leaders, nLeaders});
+  else if (leaders != MPI::COMM_NULL)
+    leaders.Free();
+
+  return comms;
+}
+
+void WriteCsv(std::ostream &out, const std::vector<Record> &records) {
+  out << "op,nonblocking,comm,comm_size,size,p50_us,p99_us,max_us,mean_us\n";
+  for (const auto &rec : records)
+    out << CollectiveName(rec.Op) << "," << rec.Nonblocking << "," << rec.Kind
+        << "," << rec.CommSize << "," << rec.Size << "," << rec.Us.P50 << ","
+        << rec.Us.P99 << "," << rec.Us.Max << "," << rec.Us.Mean << "\n";
+}
+
+void WriteJson(std::ostream &out, const std::vector<Record> &records) {
+  out << "[\n";
+  for (size_t i = 0; i < records.size(); ++i) {
+    const auto &rec = records[i];
+    out << "  {\"op\": \"" << CollectiveName(rec.Op)
+        << "\", \"nonblocking\": " << (rec.Nonblocking ? "true" : "false")
+        << ", \"comm\": \"" << rec.Kind << "\", \"comm_size\": " << rec.CommSize
+        << ", \"size\": " << rec.Size << ", \"p50_us\": " << rec.Us.P50
+        << ", \"p99_us\": " << rec.Us.P99 << ", \"max_us\": " << rec.Us.Max
+        << ", \"mean_us\": " << rec.Us.Mean << "}"
+        << (i + 1 < records.size() ? ",\n" : "\n");
+  }
+  out << "]\n";
+}
+
+int main(int argc, char *argv[]) try {
+  MPI::Init(argc, argv);
+  Defer _([] { MPI::Finalize(); });
+
+  const int crank = MPI::COMM_WORLD.Get_rank();
+
+  if (argc < 2 || argc > 4) {
+    if (crank == 0)
+      std::cout << "Usage: mpirun -np <NPROC> ./2-Collectives <nreps> "
+                   "[max_size] [out.csv|out.json]\n"
+                   "  nreps:    timed calls per point, plus 10% of warm-up\n"
+                   "  max_size: largest message per rank in bytes "
+                   "(default 1MiB)"
+                << std::endl;
+    return 1;
+  }
+
+  MPILogger log("log.txt", "Process #" + std::to_string(crank));
+
+  size_t nreps = std::stoul(argv[1]);
+  size_t nwarmup = std::max<size_t>(1, nreps / 10);
+  size_t maxSize = argc > 2 ? std::stoul(argv[2]) : 1 << 20;
+  std::string outName = argc > 3 ? argv[3] : "";
+
+  if (nreps == 0)
+    throw std::runtime_error("nreps should be non zero");
+
+  auto comms = MakeSubcomms();
+  Defer freeComms([&comms] {
+    for (auto &sub : comms)
+      if (sub.Comm != MPI::COMM_NULL)
+        sub.Comm.Free();
+  });
+
+  const Collective ops[] = {Collective::Bcast, Collective::Reduce,
+                            Collective::Allreduce, Collective::Allgather,
+                            Collective::Alltoall};
+  std::vector<Record> records;
+
+  for (auto &sub : comms) {
+    if (sub.Comm == MPI::COMM_NULL)
+      continue;
+
+    // Allgather and Alltoall need a block per peer
+    Buffers buf{std::vector<char>(maxSize * sub.Size, 1),
+                std::vector<char>(maxSize * sub.Size)};
+
+    for (size_t size = 1; size <= maxSize; size *= 2) {
+      for (Collective op : ops) {
+        if (!IsMeasured(op, size))
+          continue;
+
+        for (bool nonblocking : {false, true}) {
+          Stats stats = Measure(op, nonblocking, sub.Comm, size, buf, nreps,
+                                nwarmup);
+          records.push_back({op, nonblocking, sub.Kind, sub.Size, size, stats});
+        }
+      }
+    }
+
+    // Out of the timed path
+    log << "Done with " << sub.Kind << " of " << sub.Size << " ranks"
+        << MPILogger::endl;
+  }
+
+  log.Flush();
+
+  if (crank != 0)
+    return 0;
+
+  std::cout << std::left << std::setw(11) << "op" << std::setw(4) << "nb"
+            << std::setw(8) << "comm" << std::right << std::setw(6) << "np"
+            << std::setw(10) << "size" << std::setw(12) << "p50us"
+            << std::setw(12) << "p99us" << std::setw(12) << "maxus"
+            << std::endl;
+
+  for (const auto &rec : records)
+    std::cout << std::left << std::setw(11) << CollectiveName(rec.Op)
+              << std::setw(4) << rec.Nonblocking << std::setw(8) << rec.Kind
+              << std::right << std::setw(6) << rec.CommSize << std::setw(10)
+              << rec.Size << std::setw(12) << rec.Us.P50 << std::setw(12)
+              << rec.Us.P99 << std::setw(12) << rec.Us.Max << std::endl;
+
+  if (!outName.empty()) {
+    std::ofstream out(outName);
+    bool json = outName.size() >= 5 &&
+                outName.compare(outName.size() - 5, 5, ".json") == 0;
+    if (json)
+      WriteJson(out, records);
+    else
+      WriteCsv(out, records);
+
+    if (!out)
+      throw std::runtime_error("Failed to write " + outName);
+  }
+
+  return 0;
+} catch (std::exception &e) {
+  std::cerr << "std::exception: " << e.what() << std::endl;
+  return 1;
+} catch (MPI::Exception &e) {
+  std::cerr << "MPI::Exception: " << e.Get_error_string() << std::endl;
+  return 1;
+}
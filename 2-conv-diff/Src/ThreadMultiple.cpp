@@ -0,0 +1,305 @@
+#include "Common.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <latch>
+#include <mpi.h>
+#include <thread>
+#include <vector>
+
+// Non-blocking operations in flight per stream in the message rate test
+static constexpr size_t Window = 64;
+
+// How the threads of a rank talk to the peer rank:
+//  - Shared:   all threads use COMM_WORLD with the same tag, any thread
+//              may match any message
+//  - Dup:      every thread has its own duplicate of COMM_WORLD
+//  - Tags:     COMM_WORLD, thread t uses tag t
+//  - Funneled: the main thread drives the streams of all threads alone,
+//              the only mode that works without MPI_THREAD_MULTIPLE
+enum class ThreadMode { Shared, Dup, Tags, Funneled };
+
+const char *ThreadModeName(ThreadMode mode) {
+  switch (mode) {
+  case ThreadMode::Shared:
+    return "shared";
+  case ThreadMode::Dup:
+    return "dup";
+  case ThreadMode::Tags:
+    return "tags";
+  case ThreadMode::Funneled:
+    return "funneled";
+  }
+  return "?";
+}
+
+// Stream of messages between a thread and its peer
+struct Channel {
+  MPI::Intracomm Comm;
+  int Tag;
+};
+
+Channel ChannelOf(ThreadMode mode, size_t thread,
+                  const std::vector<MPI::Intracomm> &dups) {
+  switch (mode) {
+  case ThreadMode::Shared:
+    return {MPI::COMM_WORLD, 0};
+  case ThreadMode::Dup:
+    return {dups[thread], 0};
+  case ThreadMode::Tags:
+  case ThreadMode::Funneled:
+    return {MPI::COMM_WORLD, int(thread)};
+  }
+  return {MPI::COMM_WORLD, 0};
+}
+
+// nMsgs messages per channel from the sender to the receiver, Window of
+// them in flight per channel. Zero-byte acks keep the sender until
+// everything has arrived
+void StreamMessages(const std::vector<Channel> &channels, bool sender,
+                    int peer, size_t nMsgs, size_t size,
+                    std::vector<char> &buf) {
+  std::vector<MPI::Request> requests(channels.size() * Window);
+
+  for (size_t done = 0; done < nMsgs; done += Window) {
+    size_t n = std::min(Window, nMsgs - done);
+    size_t k = 0;
+
+    for (const auto &ch : channels)
+      for (size_t i = 0; i < n; ++i, ++k)
+        requests[k] =
+            sender ? ch.Comm.Isend(buf.data(), size, MPI::BYTE, peer, ch.Tag)
+                   : ch.Comm.Irecv(buf.data() + k * size, size, MPI::BYTE,
+                                   peer, ch.Tag);
+
+    MPI::Request::Waitall(k, requests.data());
+  }
+
+  for (size_t c = 0; c < channels.size(); ++c) {
+    const auto &ch = channels[c];
+    requests[c] = sender ? ch.Comm.Irecv(nullptr, 0, MPI::BYTE, peer, ch.Tag)
+                         : ch.Comm.Isend(nullptr, 0, MPI::BYTE, peer, ch.Tag);
+  }
+  MPI::Request::Waitall(channels.size(), requests.data());
+}
+
+// nIters round trips on every channel at once
+void PingPongs(const std::vector<Channel> &channels, bool first, int peer,
+               size_t nIters, size_t size, std::vector<char> &buf) {
+  std::vector<MPI::Request> requests(channels.size());
+
+  auto exchange = [&](bool send) {
+    for (size_t c = 0; c < channels.size(); ++c) {
+      const auto &ch = channels[c];
+      char *ptr = buf.data() + c * size;
+      requests[c] = send ? ch.Comm.Isend(ptr, size, MPI::BYTE, peer, ch.Tag)
+                         : ch.Comm.Irecv(ptr, size, MPI::BYTE, peer, ch.Tag);
+    }
+    MPI::Request::Waitall(channels.size(), requests.data());
+  };
+
+  for (size_t i = 0; i < nIters; ++i) {
+    exchange(first);
+    exchange(!first);
+  }
+}
+
+enum class Test { Rate, Latency };
+
+// Seconds of the slowest rank, valid on rank 0. Threads are started
+// before the clock and released together after a barrier
+double RunTest(Test test, ThreadMode mode, size_t nThreads, size_t count,
+               size_t size, const std::vector<MPI::Intracomm> &dups) {
+  int rank = MPI::COMM_WORLD.Get_rank();
+  int peer = rank ^ 1;
+  bool first = rank % 2 == 0;
+
+  auto body = [&](const std::vector<Channel> &channels) {
+    std::vector<char> buf(channels.size() * Window * std::max<size_t>(size, 1));
+    if (test == Test::Rate)
+      StreamMessages(channels, first, peer, count, size, buf);
+    else
+      PingPongs(channels, first, peer, count, size, buf);
+  };
+
+  double start = 0;
+
+  if (mode == ThreadMode::Funneled) {
+    std::vector<Channel> channels;
+    for (size_t t = 0; t < nThreads; ++t)
+      channels.push_back(ChannelOf(mode, t, dups));
+
+    MPI::COMM_WORLD.Barrier();
+    start = MPI::Wtime();
+    body(channels);
+  } else {
+    std::latch go(1);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < nThreads; ++t)
+      threads.emplace_back([&, t] {
+        std::vector<Channel> channels{ChannelOf(mode, t, dups)};
+        go.wait();
+        body(channels);
+      });
+
+    MPI::COMM_WORLD.Barrier();
+    start = MPI::Wtime();
+    go.count_down();
+
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  double local = MPI::Wtime() - start;
+  double seconds = 0;
+  MPI::COMM_WORLD.Reduce(&local, &seconds, 1, MPI::DOUBLE, MPI::MAX, 0);
+  return seconds;
+}
+
+const char *ThreadLevelName(int level) {
+  switch (level) {
+  case MPI::THREAD_SINGLE:
+    return "single";
+  case MPI::THREAD_FUNNELED:
+    return "funneled";
+  case MPI::THREAD_SERIALIZED:
+    return "serialized";
+  case MPI::THREAD_MULTIPLE:
+    return "multiple";
+  }
+  return "?";
+}
+
+struct Record {
+  int Level;  // Provided by MPI::Init_thread
+  ThreadMode Mode;
+  size_t NThreads;
+  double MMsgsPerS;  // Messages from one rank to its peer, all threads
+  double LatencyUs;  // One way, per stream
+};
+
+void WriteCsv(std::ostream &out, const std::vector<Record> &records) {
+  out << "level,mode,threads,mmsgs_per_s,latency_us\n";
+  for (const auto &rec : records)
+    out << ThreadLevelName(rec.Level) << "," << ThreadModeName(rec.Mode)
+        << "," << rec.NThreads << "," << rec.MMsgsPerS << ","
+        << rec.LatencyUs << "\n";
+}
+
+int main(int argc, char *argv[]) try {
+  // THREAD_LEVEL=funneled measures the funneled mode in a process that
+  // never asked for MPI_THREAD_MULTIPLE, i.e. without the library's
+  // thread-safety overhead
+  std::string level = getenv("THREAD_LEVEL") ? getenv("THREAD_LEVEL") : "";
+  if (!level.empty() && level != "funneled" && level != "multiple")
+    throw std::runtime_error("THREAD_LEVEL should be funneled or multiple");
+
+  int required =
+      level == "funneled" ? MPI::THREAD_FUNNELED : MPI::THREAD_MULTIPLE;
+  int provided = MPI::Init_thread(argc, argv, required);
+  Defer _([] { MPI::Finalize(); });
+
+  if (provided < MPI::THREAD_FUNNELED)
+    throw std::runtime_error("MPI_THREAD_FUNNELED is not provided");
+
+  const int csize = MPI::COMM_WORLD.Get_size();
+  const int crank = MPI::COMM_WORLD.Get_rank();
+
+  if (argc < 2 || argc > 5) {
+    if (crank == 0)
+      std::cout << "Usage: mpirun -np <2*NPAIRS> ./2-ThreadMultiple <nmsgs> "
+                   "[size] [max_threads] [out.csv]\n"
+                   "  nmsgs:       messages per thread in the rate test, "
+                   "nmsgs / 10 round trips in the latency test\n"
+                   "  size:        message size in bytes (default 8)\n"
+                   "  max_threads: threads per rank go 1, 2, 4 .. "
+                   "max_threads (default 8)\n"
+                   "  THREAD_LEVEL=funneled: init with MPI_THREAD_FUNNELED, "
+                   "funneled mode only"
+                << std::endl;
+    return 1;
+  }
+
+  if (csize % 2 != 0)
+    throw std::runtime_error("NP should be even: ranks 2k and 2k+1 pair up");
+
+  size_t nMsgs = std::stoul(argv[1]);
+  size_t size = argc > 2 ? std::stoul(argv[2]) : 8;
+  size_t maxThreads = argc > 3 ? std::stoul(argv[3]) : 8;
+  std::string outName = argc > 4 ? argv[4] : "";
+  size_t nIters = std::max<size_t>(1, nMsgs / 10);
+
+  if (nMsgs == 0 || maxThreads == 0)
+    throw std::runtime_error("nmsgs and max_threads should be non zero");
+
+  std::vector<ThreadMode> modes = {ThreadMode::Funneled};
+  if (required == MPI::THREAD_MULTIPLE && provided >= MPI::THREAD_MULTIPLE)
+    modes.insert(modes.begin(),
+                 {ThreadMode::Shared, ThreadMode::Dup, ThreadMode::Tags});
+  else if (required == MPI::THREAD_MULTIPLE && crank == 0)
+    std::cout << "Warning: no MPI_THREAD_MULTIPLE (provided " << provided
+              << "), only funneled mode is measured" << std::endl;
+
+  MPILogger log("log.txt", "Process #" + std::to_string(crank));
+
+  // Created once, outside of the timed path
+  std::vector<MPI::Intracomm> dups(maxThreads);
+  for (auto &comm : dups)
+    comm = MPI::COMM_WORLD.Dup();
+  Defer freeDups([&dups] {
+    for (auto &comm : dups)
+      comm.Free();
+  });
+
+  std::vector<Record> records;
+
+  for (ThreadMode mode : modes) {
+    for (size_t nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+      // Warm-up: connections, per-communicator state
+      RunTest(Test::Rate, mode, nThreads, Window, size, dups);
+
+      double rate = RunTest(Test::Rate, mode, nThreads, nMsgs, size, dups);
+      double lat = RunTest(Test::Latency, mode, nThreads, nIters, size, dups);
+
+      records.push_back({provided, mode, nThreads,
+                         nThreads * nMsgs / rate / 1e6,
+                         lat / nIters / 2 * 1e6});
+
+      // Out of the timed path
+      log << ThreadModeName(mode) << ", " << nThreads << " threads done"
+          << MPILogger::endl;
+    }
+  }
+
+  log.Flush();
+
+  if (crank != 0)
+    return 0;
+
+  std::cout << "MPI thread level: " << ThreadLevelName(provided) << std::endl;
+  std::cout << std::left << std::setw(10) << "mode" << std::right
+            << std::setw(8) << "threads" << std::setw(12) << "Mmsg/s"
+            << std::setw(14) << "latency_us" << std::endl;
+
+  for (const auto &rec : records)
+    std::cout << std::left << std::setw(10) << ThreadModeName(rec.Mode)
+              << std::right << std::setw(8) << rec.NThreads << std::setw(12)
+              << rec.MMsgsPerS << std::setw(14) << rec.LatencyUs << std::endl;
+
+  if (!outName.empty()) {
+    std::ofstream out(outName);
+    WriteCsv(out, records);
+    if (!out)
+      throw std::runtime_error("Failed to write " + outName);
+  }
+
+  return 0;
+} catch (std::exception &e) {
+  std::cerr << "std::exception: " << e.what() << std::endl;
+  return 1;
+} catch (MPI::Exception &e) {
+  std::cerr << "MPI::Exception: " << e.Get_error_string() << std::endl;
+  return 1;
+}
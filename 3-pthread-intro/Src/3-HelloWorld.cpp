@@ -1,5 +1,6 @@
 #include <pthread.h>
 
+#include <Trace.hpp>
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -17,8 +18,8 @@ void* ThreadRoutine(void* argptr) {
 
   ThreadArg arg = *reinterpret_cast<ThreadArg*>(argptr);
 
-  std::cout << "tid " << pthread_self() << ": id " << arg.Id << "/"
-            << arg.NWorkers << std::endl;
+  // Workers don't contend for std::cout, the drainer formats the records
+  TraceEvent("hello", arg.Id, arg.NWorkers);
 
   return nullptr;
 }
@@ -43,8 +44,13 @@ int main(int argc, char** argv) {
 
   size_t nWorkers = std::stoul(argv[1]);
 
-  std::vector<ThreadPtr> threads(nWorkers);
+  // Declared before the threads, so they are joined before it is closed,
+  // also when thread creation throws
+  ScopedTrace trace(std::cout);
+
+  // Threads are joined before their args are destroyed
   std::vector<ThreadArg> args (nWorkers);
+  std::vector<ThreadPtr> threads(nWorkers);
 
   for (size_t i = 0; i < nWorkers; ++i) {
     args[i].Id = i;
@@ -58,4 +64,4 @@ int main(int argc, char** argv) {
 
     threads[i] = ThreadPtr{new pthread_t{newThread}};
   }
-}
\ No newline at end of file
+}
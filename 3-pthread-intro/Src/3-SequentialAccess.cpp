@@ -1,26 +1,23 @@
+#include <linux/futex.h>
 #include <pthread.h>
-#include <signal.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
+#include <Affinity.hpp>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <numeric>
 #include <stdexcept>
-#include <vector>
 #include <string>
-
-
-struct ThreadArg {
-  pthread_mutex_t* Mutex;
-  pthread_cond_t* WakeUpCond;
-  pthread_cond_t* FinishedCond;
-  bool* WakeUpFlag;
-  bool* FinishedFlag;
-
-  size_t* Value;
-  size_t SelfId;
-};
+#include <vector>
 
 std::string ErrorString(const char* name, size_t line, int err) {
   return std::string(name) + " at line " + std::to_string(line) + ": " +
@@ -44,27 +41,6 @@ int PthreadCallNoexcept(F func, const char* name, size_t line, Args... args) {
 #define PCALL_NOEXCEPT(func, ...) \
   PthreadCallNoexcept(func, #func, __LINE__, __VA_ARGS__)
 
-void* ThreadRoutine(void* argptr) {
-  assert(argptr);
-  ThreadArg arg = *reinterpret_cast<ThreadArg*>(argptr);
-  assert(arg.WakeUpCond);
-  assert(arg.FinishedCond);
-  assert(arg.WakeUpFlag);
-  assert(arg.FinishedFlag);
-  assert(arg.Mutex);
-  assert(arg.Value);
-
-  PCALL(pthread_mutex_lock, arg.Mutex);
-  while (!(*arg.WakeUpFlag)) PCALL(pthread_cond_wait, arg.WakeUpCond, arg.Mutex);
-
-  std::cout << "Thread " << arg.SelfId << ": " << ((*arg.Value) *= 2) << std::endl;
-  *arg.FinishedFlag = true;
-  PCALL(pthread_cond_signal, arg.FinishedCond);
-  PCALL(pthread_mutex_unlock, arg.Mutex);
-
-  return nullptr;
-}
-
 struct MutexDeleter {
   void operator()(pthread_mutex_t* ptr) noexcept {
     if (!ptr) return;
@@ -81,78 +57,347 @@ struct CondDeleter {
   }
 };
 
+// Chain threads always run to completion, so a plain join is enough
 struct ThreadDeleter {
   void operator()(pthread_t* ptr) noexcept {
     if (!ptr) return;
-    DeleteStrategy(*ptr);
+    PCALL_NOEXCEPT(pthread_join, *ptr, nullptr);
     delete ptr;
   }
-
-  static void DeleteStrategy(const pthread_t & tid) {
-    int ret = PCALL_NOEXCEPT(pthread_tryjoin_np, tid, nullptr);
-    if (ret != EBUSY) return;
-
-    PCALL_NOEXCEPT(pthread_kill, tid, SIGKILL);
-    PCALL_NOEXCEPT(pthread_join, tid, nullptr);    
-  }
 };
 
 using MutexPtr = std::unique_ptr<pthread_mutex_t, MutexDeleter>;
 using CondPtr = std::unique_ptr<pthread_cond_t, CondDeleter>;
 using ThreadPtr = std::unique_ptr<pthread_t, ThreadDeleter>;
 
-std::vector<CondPtr> MakeCondVec(size_t count) {
-  std::vector<CondPtr> cVec(count);
+MutexPtr MakeMutex() {
+  return MutexPtr{new pthread_mutex_t(PTHREAD_MUTEX_INITIALIZER)};
+}
+
+CondPtr MakeCond() {
+  return CondPtr{new pthread_cond_t(PTHREAD_COND_INITIALIZER)};
+}
 
-  for (CondPtr& cond : cVec) {
-    CondPtr newCond{new pthread_cond_t(PTHREAD_COND_INITIALIZER)};
-    cond = std::move(newCond);
-  }
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
 
-  return cVec;
+long Futex(std::atomic<uint32_t>* addr, int op, uint32_t val) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), op, val,
+                 nullptr, nullptr, 0);
 }
 
-int main(int argc, char** argv) {
-  if (argc != 2) {
-    std::cout << "Usage: ./3-SequentialAccess <NTHREADS>" << std::endl;
-    return 1;
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// Links between neighbours of the chain. Post() is called by the previous
+// thread, Wait(target) by the next one and returns once target posts have
+// happened, so a link never has to be reset between rounds. Shared is the
+// state common to all links of a chain
+
+// One mutex for the whole chain and a condition per link, as the original
+// sample did: every hand-off contends for the same lock
+class GlobalCondLink final {
+ public:
+  struct Shared {
+    MutexPtr Mutex = MakeMutex();
+  };
+
+ private:
+  pthread_mutex_t* Mutex;
+  CondPtr Cond = MakeCond();
+  uint32_t Count = 0;
+
+ public:
+  explicit GlobalCondLink(Shared& shared) : Mutex{shared.Mutex.get()} {}
+
+  void Post() {
+    PCALL(pthread_mutex_lock, Mutex);
+    ++Count;
+    PCALL(pthread_cond_signal, Cond.get());
+    PCALL(pthread_mutex_unlock, Mutex);
   }
 
-  size_t nThreads = std::stoul(argv[1]);
-  size_t value = 1;
+  void Wait(uint32_t target) {
+    PCALL(pthread_mutex_lock, Mutex);
+    while (Count < target) PCALL(pthread_cond_wait, Cond.get(), Mutex);
+    PCALL(pthread_mutex_unlock, Mutex);
+  }
+};
+
+// Mutex and condition per link: only the two neighbours touch it
+class PerLinkCondLink final {
+ public:
+  struct Shared {};
 
-  MutexPtr mutex{new pthread_mutex_t(PTHREAD_MUTEX_INITIALIZER)};
+ private:
+  MutexPtr Mutex = MakeMutex();
+  CondPtr Cond = MakeCond();
+  uint32_t Count = 0;
 
-  std::vector<CondPtr> wakeUpConds = MakeCondVec(nThreads + 1);
-  std::basic_string<bool> wakeUpFlags (nThreads + 1, false);
+ public:
+  explicit PerLinkCondLink(Shared&) {}
 
-  std::vector<ThreadPtr> threads (nThreads);
-  std::vector<ThreadArg> args (nThreads);
+  void Post() {
+    PCALL(pthread_mutex_lock, Mutex.get());
+    ++Count;
+    PCALL(pthread_cond_signal, Cond.get());
+    PCALL(pthread_mutex_unlock, Mutex.get());
+  }
+
+  void Wait(uint32_t target) {
+    PCALL(pthread_mutex_lock, Mutex.get());
+    while (Count < target) PCALL(pthread_cond_wait, Cond.get(), Mutex.get());
+    PCALL(pthread_mutex_unlock, Mutex.get());
+  }
+};
 
-  for (int i = 0; i < nThreads; ++i) {
-    args[i].Mutex = mutex.get();
-    args[i].SelfId = i;
-    args[i].Value = &value;
-    
-    args[i].WakeUpCond = wakeUpConds[i].get();
-    args[i].WakeUpFlag = &wakeUpFlags[i];
+// C++20 atomic wait/notify, the library decides how long to spin
+class AtomicWaitLink final {
+ public:
+  struct Shared {};
 
-    args[i].FinishedCond = wakeUpConds[i + 1].get();
-    args[i].FinishedFlag = &wakeUpFlags[i + 1];
+ private:
+  alignas(CacheLineSize) std::atomic<uint32_t> Count{0};
 
-    ThreadPtr newThread {new pthread_t};
-    PCALL(pthread_create, newThread.get(), nullptr, ThreadRoutine, &args[i]);
-    threads[i] = std::move(newThread);
+ public:
+  explicit AtomicWaitLink(Shared&) {}
+
+  void Post() {
+    Count.fetch_add(1, std::memory_order_release);
+    Count.notify_one();
   }
 
-  PCALL(pthread_mutex_lock, mutex.get());
-  wakeUpFlags[0] = true;
-  PCALL(pthread_cond_signal, wakeUpConds[0].get());
+  void Wait(uint32_t target) {
+    uint32_t val;
+    while ((val = Count.load(std::memory_order_acquire)) < target)
+      Count.wait(val, std::memory_order_acquire);
+  }
+};
 
-  while(!(wakeUpFlags[nThreads]))
-    PCALL(pthread_cond_wait, wakeUpConds[nThreads].get(), mutex.get());
-  
-  std::cout << "Last thread finished, value = " << value << std::endl;
+// Raw futex: a wake syscall on every post, a wait syscall whenever the
+// count isn't there yet
+class FutexLink final {
+ public:
+  struct Shared {};
 
-  PCALL(pthread_mutex_unlock, mutex.get());
-}
\ No newline at end of file
+ private:
+  alignas(CacheLineSize) std::atomic<uint32_t> Count{0};
+
+ public:
+  explicit FutexLink(Shared&) {}
+
+  void Post() {
+    Count.fetch_add(1, std::memory_order_release);
+    Futex(&Count, FUTEX_WAKE_PRIVATE, 1);
+  }
+
+  void Wait(uint32_t target) {
+    uint32_t val;
+    while ((val = Count.load(std::memory_order_acquire)) < target)
+      Futex(&Count, FUTEX_WAIT_PRIVATE, val);
+  }
+};
+
+// Spins for at most SpinLimit, then parks on the futex. The spin yields
+// every SpinBatch iterations, so that on an oversubscribed machine the
+// poster isn't kept off the CPU by the spinning waiter. Post() makes the
+// wake syscall only if the waiter announced itself: the waiter stores
+// Parked before it rechecks Count, the poster adds to Count before it
+// loads Parked, both seq_cst, so at least one of them sees the other
+class SpinParkLink final {
+ public:
+  static constexpr auto SpinLimit = std::chrono::microseconds(20);
+  static constexpr size_t SpinBatch = 64;
+
+  struct Shared {};
+
+ private:
+  alignas(CacheLineSize) std::atomic<uint32_t> Count{0};
+  std::atomic<uint32_t> Parked{0};
+
+ public:
+  explicit SpinParkLink(Shared&) {}
+
+  void Post() {
+    Count.fetch_add(1);
+    if (Parked.load()) Futex(&Count, FUTEX_WAKE_PRIVATE, 1);
+  }
+
+  void Wait(uint32_t target) {
+    auto deadline = std::chrono::steady_clock::now() + SpinLimit;
+
+    do {
+      for (size_t i = 0; i < SpinBatch; ++i) {
+        if (Count.load(std::memory_order_acquire) >= target) return;
+        CpuRelax();
+      }
+      sched_yield();
+    } while (std::chrono::steady_clock::now() < deadline);
+
+    while (true) {
+      Parked.store(1);
+      uint32_t val = Count.load();
+      if (val >= target) break;
+      Futex(&Count, FUTEX_WAIT_PRIVATE, val);
+    }
+    Parked.store(0, std::memory_order_relaxed);
+  }
+};
+
+template <typename Link>
+struct ThreadArg {
+  std::vector<std::unique_ptr<Link>>* Links;
+  pthread_barrier_t* Ready;
+  size_t* Value;
+  size_t SelfId;
+  size_t NRounds;
+};
+
+// Thread i waits on link i and posts link i + 1 (mod n), the token makes
+// NRounds laps around the ring
+template <typename Link>
+void* ThreadRoutine(void* argptr) {
+  assert(argptr);
+  ThreadArg<Link> arg = *reinterpret_cast<ThreadArg<Link>*>(argptr);
+  assert(arg.Links);
+  assert(arg.Ready);
+  assert(arg.Value);
+
+  auto& links = *arg.Links;
+  Link& self = *links[arg.SelfId];
+  Link& next = *links[(arg.SelfId + 1) % links.size()];
+
+  pthread_barrier_wait(arg.Ready);
+
+  for (size_t round = 0; round < arg.NRounds; ++round) {
+    self.Wait(uint32_t(round + 1));  // NRounds fits, see main
+    ++*arg.Value;  // Ordered by the hand-offs
+    next.Post();
+  }
+
+  return nullptr;
+}
+
+double CpuSeconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  auto seconds = [](const timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  };
+  return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+struct HandOffResult {
+  double NsPerHandOff;
+  double CpuNsPerHandOff;  // CPU time of all threads, spinning included
+  double CpuPerWall;       // Cores kept busy on average
+};
+
+// nThreads * nRounds hand-offs, the first one is made by the main thread
+template <typename Link>
+HandOffResult RunChain(size_t nThreads, size_t nRounds,
+                       const PlacementPolicy& placement) {
+  typename Link::Shared shared;
+  std::vector<std::unique_ptr<Link>> links(nThreads);
+  for (auto& link : links) link = std::make_unique<Link>(shared);
+
+  pthread_barrier_t ready;
+  PCALL(pthread_barrier_init, &ready, nullptr, nThreads + 1);
+
+  size_t value = 0;
+  std::vector<ThreadArg<Link>> args(nThreads);
+  double wallSeconds, cpuSeconds;
+
+  {
+    std::vector<ThreadPtr> threads(nThreads);
+
+    for (size_t i = 0; i < nThreads; ++i) {
+      args[i] = {&links, &ready, &value, i, nRounds};
+
+      pthread_attr_t attr;
+      PCALL(pthread_attr_init, &attr);
+      placement.Apply(&attr, i);
+
+      ThreadPtr newThread{new pthread_t};
+      PCALL(pthread_create, newThread.get(), &attr, ThreadRoutine<Link>,
+            &args[i]);
+      PCALL(pthread_attr_destroy, &attr);
+      threads[i] = std::move(newThread);
+    }
+
+    pthread_barrier_wait(&ready);
+
+    double cpuStart = CpuSeconds();
+    auto start = std::chrono::steady_clock::now();
+    links[0]->Post();
+
+    // joining
+    threads.clear();
+
+    wallSeconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    cpuSeconds = CpuSeconds() - cpuStart;
+  }
+
+  PCALL_NOEXCEPT(pthread_barrier_destroy, &ready);
+
+  if (value != nThreads * nRounds)
+    throw std::runtime_error("Lost hand-offs: " + std::to_string(value));
+
+  double nHandOffs = nThreads * nRounds;
+  return {wallSeconds / nHandOffs * 1e9, cpuSeconds / nHandOffs * 1e9,
+          cpuSeconds / wallSeconds};
+}
+
+template <typename Link>
+void Report(const char* name, size_t nThreads, size_t nRounds,
+            const PlacementPolicy& unpinned, const PlacementPolicy& pinned) {
+  for (const auto* placement : {&unpinned, &pinned}) {
+    auto res = RunChain<Link>(nThreads, nRounds, *placement);
+    std::cout << std::left << std::setw(12) << name << std::setw(8)
+              << (placement == &pinned ? "yes" : "no") << std::right
+              << std::fixed << std::setprecision(1) << std::setw(12)
+              << res.NsPerHandOff << std::setw(12) << res.CpuNsPerHandOff
+              << std::setprecision(2) << std::setw(10) << res.CpuPerWall
+              << std::endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 4) {
+    std::cout << "Usage: ./3-SequentialAccess <NTHREADS> [NROUNDS] "
+                 "[PLACEMENT]\n"
+                 "  NROUNDS: laps of the token around the chain "
+                 "(default 10000)\n"
+                 "  PLACEMENT: compact (default), scatter, CPU list "
+                 "(0,2,4-7) for the pinned runs"
+              << std::endl;
+    return 1;
+  }
+
+  size_t nThreads = std::stoul(argv[1]);
+  size_t nRounds = argc > 2 ? std::stoul(argv[2]) : 10000;
+  auto pinned = PlacementPolicy::Parse(argc > 3 ? argv[3] : "compact");
+  auto unpinned = PlacementPolicy::Parse("none");
+
+  if (nThreads < 2) throw std::runtime_error("Need at least 2 threads");
+  if (nRounds == 0) throw std::runtime_error("nRounds should be non zero");
+
+  // Link counts are 32-bit: futex words
+  if (nRounds > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("nRounds should fit into 32 bits");
+
+  std::cout << std::left << std::setw(12) << "primitive" << std::setw(8)
+            << "pinned" << std::right << std::setw(12) << "ns/handoff"
+            << std::setw(12) << "cpu ns" << std::setw(10) << "cpu/wall"
+            << std::endl;
+
+  Report<GlobalCondLink>("global", nThreads, nRounds, unpinned, pinned);
+  Report<PerLinkCondLink>("per-link", nThreads, nRounds, unpinned, pinned);
+  Report<AtomicWaitLink>("atomic", nThreads, nRounds, unpinned, pinned);
+  Report<FutexLink>("futex", nThreads, nRounds, unpinned, pinned);
+  Report<SpinParkLink>("spin-park", nThreads, nRounds, unpinned, pinned);
+}
@@ -1,7 +1,12 @@
 #include <pthread.h>
 
+#include <Affinity.hpp>
+#include <Series.hpp>
+#include <Trace.hpp>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 #include <numeric>
@@ -9,10 +14,10 @@
 #include <vector>
 
 struct ThreadArg {
-  size_t Start;
-  size_t Count;
-  double (*Function)(size_t);
-  double* Dst;
+  const ChunkedRange* Range;
+  size_t FirstChunk;
+  size_t LastChunk;
+  std::vector<double>* Dst;  // Partials of the thread's chunks
 };
 
 struct ThreadDeleter {
@@ -31,63 +36,86 @@ using ThreadPtr = std::unique_ptr<pthread_t, ThreadDeleter>;
 void* ThreadRoutine(void* argptr) {
   assert(argptr);
   ThreadArg arg = *reinterpret_cast<ThreadArg*>(argptr);
-  assert(arg.Function);
+  assert(arg.Range);
   assert(arg.Dst);
 
-  double sum = 0;
+  // Allocated here, so that the block is first-touched on the thread's node
+  std::vector<double> block(arg.LastChunk - arg.FirstChunk);
 
-  for (size_t i = 0; i < arg.Count; ++i) sum += arg.Function(arg.Start + i);
+  TraceEvent("chunks begin", arg.FirstChunk, arg.LastChunk);
+  SumSeriesChunks(HarmonicTerm{}, *arg.Range, arg.FirstChunk, arg.LastChunk,
+                  block.data());
+  TraceEvent("chunks end", arg.FirstChunk, arg.LastChunk);
 
-  *arg.Dst = sum;
+  *arg.Dst = std::move(block);
 
   return nullptr;
 }
 
-double function(size_t N) { return 1. / (N + 1); }
-
 void PrintResult(double sum, size_t nTerms) {
-  std::cout << "Sum [1, " << nTerms << "] = " << sum << std::endl;
+  // Reference: 64 exact terms and Euler-Maclaurin for the rest
+  auto ref = SumSeriesWithTail(HarmonicTerm{}, nTerms, 64);
+
+  std::cout << std::setprecision(17) << "Sum [1, " << nTerms << "] = " << sum
+            << std::endl;
+  std::cout << "Euler-Maclaurin:   " << ref.Value << " +- " << ref.Error
+            << " (diff " << sum - ref.Value << ")" << std::endl;
 }
 
 int main(int argc, char** argv) {
-  if (argc != 3) {
-    std::cout << "Usage: ./3-SeriesSum <NTERMS> <NWORKERS>" << std::endl;
+  if (argc != 3 && argc != 4) {
+    std::cout << "Usage: ./3-SeriesSum <NTERMS> <NWORKERS> [PLACEMENT]\n"
+                 "  PLACEMENT: none (default), compact, scatter, CPU list "
+                 "(0,2,4-7)"
+              << std::endl;
     return 1;
   }
 
   size_t nTerms = std::stoul(argv[1]);
   size_t nWorkers = std::stoul(argv[2]);
+  auto placement = PlacementPolicy::Parse(argc == 4 ? argv[3] : "none");
 
   if (nWorkers == 0) throw std::runtime_error("nWorkers should be non zero");
 
-  if (nWorkers > nTerms) {
+  // Terms are summed by fixed chunks and combined by a fixed tree, so the
+  // result doesn't depend on nWorkers
+  ChunkedRange range{nTerms, SeriesChunkSize};
+
+  if (nWorkers > range.NChunks()) {
     std::cout << "Warning: too many workers, truncating" << std::endl;
-    nWorkers = nTerms;
+    nWorkers = std::max<size_t>(range.NChunks(), 1);
   }
 
+  // Worker events go to $TRACE_LOG if it is set, region stats to
+  // $INSTRUMENT
+  ScopedTrace trace;
+  ScopedInstrumentation instrumentation;
+
   if (nWorkers == 1) {
-    double sum = 0;
-    for (size_t i = 0; i < nTerms; ++i)
-      sum += function(i);
-    PrintResult(sum, nTerms);
+    std::vector<double> partials(range.NChunks());
+    SumSeriesChunks(HarmonicTerm{}, range, 0, range.NChunks(),
+                    partials.data());
+    PrintResult(TreeReduce(partials), nTerms);
     return 0;
   }
 
   std::vector<ThreadPtr> threads(nWorkers);
   std::vector<ThreadArg> args(nWorkers);
-  std::vector<double> results(nWorkers, 1e6);
-
-  size_t blockSize = nTerms / nWorkers;
-  assert(blockSize != 0);
+  std::vector<std::vector<double>> blocks(nWorkers);
 
   for (int i = 0; i < nWorkers; ++i) {
-    args[i].Function = function;
-    args[i].Start = i * blockSize;
-    args[i].Count = blockSize;
-    args[i].Dst = &results[i];
+    args[i].Range = &range;
+    args[i].FirstChunk = range.FirstOf(i, nWorkers);
+    args[i].LastChunk = range.FirstOf(i + 1, nWorkers);
+    args[i].Dst = &blocks[i];
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    placement.Apply(&attr, i);
 
     pthread_t newThread;
-    int ret = pthread_create(&newThread, NULL, ThreadRoutine, &args[i]);
+    int ret = pthread_create(&newThread, &attr, ThreadRoutine, &args[i]);
+    pthread_attr_destroy(&attr);
     if (ret != 0)
       throw std::runtime_error(std::string("Failed to create thread: ") +
                                strerror(ret));
@@ -95,13 +123,13 @@ int main(int argc, char** argv) {
     threads[i] = ThreadPtr{new pthread_t{newThread}};
   }
 
-  // joining
+  // joining, before the trace is closed
   threads.clear();
 
-  double sum = 0;
-  for (size_t i = 0; i < nTerms % blockSize; ++i)
-    sum += function(nTerms - i - 1);
+  std::vector<double> partials;
+  partials.reserve(range.NChunks());
+  for (const auto& block : blocks)
+    partials.insert(partials.end(), block.begin(), block.end());
 
-  sum = std::accumulate(results.begin(), results.end(), sum);
-  PrintResult(sum, nTerms);
-}
\ No newline at end of file
+  PrintResult(TreeReduce(partials), nTerms);
+}
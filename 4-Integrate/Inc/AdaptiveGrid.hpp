@@ -1,6 +1,10 @@
 #pragma once
 
+#include <Integrand.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
@@ -17,6 +21,7 @@ struct AdaptiveGrid {
     double End;
     double Step;
     size_t NSteps;
+    double StepCost;
   };
 
   struct HeterogenousPartition {
@@ -43,6 +48,7 @@ struct AdaptiveGrid {
       std::cout << "  End: " << part.End << std::endl;
       std::cout << "  Step: " << part.Step << std::endl;
       std::cout << "  NSteps: " << part.NSteps << std::endl;
+      std::cout << "  StepCost: " << part.StepCost << std::endl;
     }
     for (int i = 0; i < Partitions.size(); ++i) {
       std::cout << "Partition #" << i << std::endl;
@@ -60,74 +66,175 @@ struct AdaptiveGrid {
   }
 
  public:
-  // O(nWorkers*resolution)
-  static AdaptiveGrid Create(StepEvalT rem2h, FuncT func, double start,
-                             double end, double precision, size_t nWorkers,
-                             size_t resolution = 1) {
-    assert(resolution);
+  // Cost of a single step inside of [start, start + size), arbitrary units
+  using CostEvalT = double (*)(FuncT, double start, double size);
+  using BatchFuncT = void (*)(const double* x, double* out, size_t n);
 
-    size_t nPartitions = resolution;
-    std::vector<HomogenousPartition> partitions(nPartitions);
+  struct BuildConfig {
+    size_t NThreads = 1;  // Threads evaluating rem2h and costs
 
-    double partSize = (end - start) / nPartitions;
-    size_t nSteps = 0;
+    // Step cost model: CostEval if set, otherwise measured by timing
+    // CostSamples batches of each partition, otherwise uniform
+    CostEvalT CostEval = nullptr;
+    size_t CostSamples = 0;
 
-    for (int i = 0; i < nPartitions; ++i) {
+    // Integrand the costs are measured on, func if not set. Should be the
+    // one actually integrated, e.g. its batch form
+    BatchFuncT CostFunc = nullptr;
+  };
+
+  // Step costs are clamped to it, FindCut divides by them
+  static constexpr double MinStepCost = 1e-3;
+
+  // Time per evaluation of a batch of IntegrateBatchSize points spread over
+  // the partition, ns. A single call is too short for the clock, so the
+  // minimum over nSamples batches is taken
+  template <Integrand F>
+  static double MeasureStepCost(const F& func, double start, double size,
+                                size_t nSamples) {
+    alignas(64) double xs[IntegrateBatchSize];
+    alignas(64) double fs[IntegrateBatchSize];
+
+    double h = size / IntegrateBatchSize;
+    for (size_t i = 0; i < IntegrateBatchSize; ++i)
+      xs[i] = start + (i + 0.5) * h;
+
+    volatile double sink = 0;
+    double best = INFINITY;
+
+    for (size_t rep = 0; rep < nSamples; ++rep) {
+      auto begin = std::chrono::steady_clock::now();
+      EvalBatch(func, xs, fs, IntegrateBatchSize);
+      auto end = std::chrono::steady_clock::now();
+
+      sink = sink + fs[rep % IntegrateBatchSize];
+      best = std::min(
+          best, std::chrono::duration<double, std::nano>(end - begin).count());
+    }
+
+    return std::max(best / IntegrateBatchSize, MinStepCost);
+  }
+
+ private:
+  static void BuildPartitions(std::vector<HomogenousPartition>& partitions,
+                              StepEvalT rem2h, FuncT func, double start,
+                              double partSize, double precision,
+                              const BuildConfig& config, size_t begin,
+                              size_t end) {
+    for (size_t i = begin; i < end; ++i) {
       auto& part = partitions[i];
       part.Start = start + partSize * i;
       part.End = part.Start + partSize;
 
       double h = rem2h(func, part.Start, partSize, precision);
       double steps = partSize / h;
-      
-      h *= steps / ceil(steps); // Evenly quantize the interval
+
+      h *= steps / ceil(steps);  // Evenly quantize the interval
       steps = ceil(steps);
 
       part.Step = h;
       part.NSteps = steps;
 
-      nSteps += part.NSteps;
+      if (config.CostEval)
+        part.StepCost = config.CostEval(func, part.Start, partSize);
+      else if (config.CostSamples && config.CostFunc)
+        part.StepCost = MeasureStepCost(config.CostFunc, part.Start, partSize,
+                                        config.CostSamples);
+      else if (config.CostSamples)
+        part.StepCost =
+            MeasureStepCost(func, part.Start, partSize, config.CostSamples);
+      else
+        part.StepCost = 1;
+
+      // Also catches NaN from CostEval
+      if (!(part.StepCost >= MinStepCost)) part.StepCost = MinStepCost;
     }
+  }
 
-    std::vector<HeterogenousPartition> task(nWorkers);
-    size_t taskSize = ceil(double(nSteps) / nWorkers);
+  // Position of the cumulative cost target: (partition, steps taken from it)
+  static std::pair<size_t, size_t> FindCut(
+      const std::vector<HomogenousPartition>& partitions,
+      const std::vector<double>& prefix, double target) {
+    size_t index =
+        std::upper_bound(prefix.begin() + 1, prefix.end(), target) -
+        prefix.begin() - 1;
 
-    task[0].Start = start;
+    if (index >= partitions.size()) return {partitions.size(), 0};
 
-    size_t taskIndex = 0;
-    size_t taskFilled = 0;
+    const auto& part = partitions[index];
+    double steps = (target - prefix[index]) / part.StepCost;
+    size_t nSteps = std::min<size_t>(llround(steps), part.NSteps);
 
-    size_t partIndex = 0;
-    size_t partUsed = 0;
+    return {index, nSteps};
+  }
 
-    while (partIndex < nPartitions) {
-      size_t remainsInPartition = partitions[partIndex].NSteps - partUsed;
-      size_t remainsInTask = taskSize - taskFilled;
+ public:
+  // Partitions are built in parallel, worker tasks are cut at equal shares
+  // of the cumulative cost with binary search over the cost prefix sums:
+  // O(resolution / NThreads + nWorkers * log(resolution))
+  static AdaptiveGrid Create(StepEvalT rem2h, FuncT func, double start,
+                             double end, double precision, size_t nWorkers,
+                             size_t resolution,
+                             const BuildConfig& config) {
+    assert(resolution);
+    assert(nWorkers);
 
-      HeterogenousPartition::Part taskPart;
-      taskPart.Step = partitions[partIndex].Step;
-      size_t indexToPush = taskIndex;
+    size_t nPartitions = resolution;
+    std::vector<HomogenousPartition> partitions(nPartitions);
 
-      if (remainsInPartition <= remainsInTask) {
-        taskPart.NSteps = remainsInPartition;
-        taskFilled += remainsInPartition;
-        partIndex++;
-        partUsed = 0;
-      } else {  // remainsInPartition > remainsInTask
-        taskPart.NSteps = remainsInTask;
-        partUsed += remainsInTask;
+    double partSize = (end - start) / nPartitions;
 
-        taskIndex++;
-        task[taskIndex].Start = start + partSize * partIndex +
-                                partUsed * partitions[partIndex].Step;
+    auto build = [&](size_t begin, size_t end) {
+      BuildPartitions(partitions, rem2h, func, start, partSize, precision,
+                      config, begin, end);
+    };
 
-        taskFilled = 0;
-      }
+    if (config.NThreads > 1)
+      WorkStealingPool::Instance(config.NThreads).ParallelFor(nPartitions,
+                                                              build);
+    else
+      build(0, nPartitions);
+
+    std::vector<double> prefix(nPartitions + 1, 0);
+    for (size_t i = 0; i < nPartitions; ++i)
+      prefix[i + 1] =
+          prefix[i] + partitions[i].StepCost * partitions[i].NSteps;
+
+    // Task w covers [cuts[w], cuts[w + 1])
+    std::vector<std::pair<size_t, size_t>> cuts(nWorkers + 1);
+    cuts[0] = {0, 0};
+    cuts[nWorkers] = {nPartitions, 0};
+
+    for (size_t w = 1; w < nWorkers; ++w) {
+      cuts[w] = FindCut(partitions, prefix, prefix.back() * w / nWorkers);
+      cuts[w] = std::max(cuts[w], cuts[w - 1]);
+    }
+
+    std::vector<HeterogenousPartition> task(nWorkers);
+
+    for (size_t w = 0; w < nWorkers; ++w) {
+      auto [fromPart, fromStep] = cuts[w];
+      auto [toPart, toStep] = cuts[w + 1];
+
+      const auto& first = partitions[std::min(fromPart, nPartitions - 1)];
+      task[w].Start = fromPart < nPartitions
+                          ? first.Start + fromStep * first.Step
+                          : end;
 
-      task[indexToPush].Parts.push_back(taskPart);
+      for (size_t i = fromPart; i <= toPart && i < nPartitions; ++i) {
+        size_t from = (i == fromPart) ? fromStep : 0;
+        size_t to = (i == toPart) ? toStep : partitions[i].NSteps;
+        if (to > from) task[w].Parts.push_back({partitions[i].Step, to - from});
+      }
     }
 
-    assert(taskIndex >= nWorkers - 1);
     return {partitions, task};
   }
-};
\ No newline at end of file
+
+  static AdaptiveGrid Create(StepEvalT rem2h, FuncT func, double start,
+                             double end, double precision, size_t nWorkers,
+                             size_t resolution = 1) {
+    return Create(rem2h, func, start, end, precision, nWorkers, resolution,
+                  BuildConfig{});
+  }
+};
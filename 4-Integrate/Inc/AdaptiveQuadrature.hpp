@@ -0,0 +1,247 @@
+#pragma once
+
+#include <Integrand.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+// Gauss-Kronrod 7/15 rule, nodes and weights are taken from QUADPACK
+struct GaussKronrod15 {
+  static constexpr size_t NPoints = 15;
+
+  // Kronrod nodes on [0, 1], odd indices are shared with Gauss rule
+  static constexpr double XGK[8] = {
+      0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+      0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+      0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+      0.207784955007898467600689403773245, 0.000000000000000000000000000000000};
+
+  static constexpr double WGK[8] = {
+      0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+      0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+      0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+      0.204432940075298892414161999234649, 0.209482141084727828012999174891714};
+
+  static constexpr double WG[4] = {
+      0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+      0.381830050505118944950369775488975, 0.417959183673469387755102040816327};
+
+  // Abscissae of the rule on [a, b]
+  static void Nodes(double a, double b, double* x) {
+    double center = (a + b) / 2;
+    double halfLen = (b - a) / 2;
+
+    for (size_t j = 0; j < 7; ++j) {
+      x[2 * j] = center - halfLen * XGK[j];
+      x[2 * j + 1] = center + halfLen * XGK[j];
+    }
+    x[14] = center;
+  }
+
+  // Kronrod estimate and QUADPACK-style error of f values at Nodes()
+  static void Apply(double a, double b, const double* f, double& value,
+                    double& error) {
+    double halfLen = (b - a) / 2;
+
+    double resK = WGK[7] * f[14];
+    double resG = WG[3] * f[14];
+    double resAbs = WGK[7] * fabs(f[14]);
+
+    for (size_t j = 0; j < 7; ++j) {
+      double pair = f[2 * j] + f[2 * j + 1];
+      resK += WGK[j] * pair;
+      resAbs += WGK[j] * (fabs(f[2 * j]) + fabs(f[2 * j + 1]));
+      if (j % 2 == 1) resG += WG[j / 2] * pair;
+    }
+
+    double mean = resK / 2;
+    double resAsc = WGK[7] * fabs(f[14] - mean);
+    for (size_t j = 0; j < 7; ++j)
+      resAsc += WGK[j] * (fabs(f[2 * j] - mean) + fabs(f[2 * j + 1] - mean));
+
+    value = resK * halfLen;
+    error = fabs((resK - resG) * halfLen);
+
+    resAbs *= fabs(halfLen);
+    resAsc *= fabs(halfLen);
+
+    if (resAsc != 0 && error != 0)
+      error = resAsc * std::min(1., pow(200 * error / resAsc, 1.5));
+
+    constexpr double eps = std::numeric_limits<double>::epsilon();
+    if (resAbs > std::numeric_limits<double>::min() / (50 * eps))
+      error = std::max(50 * eps * resAbs, error);
+  }
+};
+
+struct QuadratureResult {
+  double Value = 0;
+  double Error = 0;
+  size_t NEvals = 0;
+  size_t NIntervals = 0;
+};
+
+struct AdaptiveQuadratureConfig {
+  size_t InitialIntervals = 1;
+  size_t MaxIntervals = 1 << 20;
+};
+
+// Bisects the interval with the largest error estimate until the sum of
+// estimates meets the absolute precision. Workers share a global max-heap
+// of intervals, so the worst part of the domain is always refined first
+template <Integrand F>
+class AdaptiveQuadrature final {
+ private:
+  using Rule = GaussKronrod15;
+
+  struct Interval {
+    double A;
+    double B;
+    double Value;
+    double Error;
+
+    bool operator<(const Interval& rhs) const { return Error < rhs.Error; }
+  };
+
+  const F& Func;
+  const double Prec;
+  const AdaptiveQuadratureConfig Config;
+
+  std::mutex Mutex;
+  std::condition_variable Changed;
+
+  std::priority_queue<Interval> Heap;
+  std::vector<Interval> Final;  // Not worth or not possible to bisect
+  double TotalError = 0;
+  size_t InFlight = 0;
+  size_t NEvals = 0;
+  bool Finished = false;
+
+ private:
+  Interval Eval(double a, double b) const {
+    double x[Rule::NPoints];
+    double f[Rule::NPoints];
+
+    Rule::Nodes(a, b, x);
+    EvalBatch(Func, x, f, Rule::NPoints);
+
+    Interval res{a, b};
+    Rule::Apply(a, b, f, res.Value, res.Error);
+    return res;
+  }
+
+  // Interval can't be bisected without midpoint collapsing on the border
+  static bool IsTooNarrow(const Interval& interval) {
+    double mid = (interval.A + interval.B) / 2;
+    double eps = std::numeric_limits<double>::epsilon();
+    double scale = std::max(fabs(interval.A), fabs(interval.B));
+    return (interval.B - interval.A) <= 100 * eps * scale || mid <= interval.A ||
+           mid >= interval.B;
+  }
+
+  // Caller holds the Mutex
+  void Push(const Interval& interval) {
+    TotalError += interval.Error;
+    if (IsTooNarrow(interval))
+      Final.push_back(interval);
+    else
+      Heap.push(interval);
+  }
+
+  // Caller holds the Mutex
+  bool IsDone() const {
+    return TotalError <= Prec ||
+           Heap.size() + Final.size() + InFlight >= Config.MaxIntervals;
+  }
+
+  void Routine() {
+    std::unique_lock<std::mutex> lock(Mutex);
+
+    while (true) {
+      Changed.wait(lock, [this] {
+        return Finished || IsDone() || !Heap.empty() || InFlight == 0;
+      });
+
+      if (Finished || IsDone() || (Heap.empty() && InFlight == 0)) {
+        Finished = true;
+        Changed.notify_all();
+        return;
+      }
+
+      Interval worst = Heap.top();
+      Heap.pop();
+      InFlight++;
+      lock.unlock();
+
+      double mid = (worst.A + worst.B) / 2;
+      Interval left = Eval(worst.A, mid);
+      Interval right = Eval(mid, worst.B);
+
+      lock.lock();
+      InFlight--;
+      NEvals += 2 * Rule::NPoints;
+      TotalError -= worst.Error;
+      Push(left);
+      Push(right);
+      Changed.notify_all();
+    }
+  }
+
+ public:
+  AdaptiveQuadrature(const F& func, double prec,
+                     const AdaptiveQuadratureConfig& config = {})
+      : Func{func}, Prec{prec}, Config{config} {
+    assert(prec > 0);
+    assert(config.InitialIntervals);
+  }
+
+  QuadratureResult Run(double a, double b, size_t nWorkers) {
+    size_t nInitial = Config.InitialIntervals;
+    double size = (b - a) / nInitial;
+
+    for (size_t i = 0; i < nInitial; ++i) {
+      double start = a + size * i;
+      double end = (i + 1 == nInitial) ? b : start + size;
+      Push(Eval(start, end));
+    }
+    NEvals += nInitial * Rule::NPoints;
+
+    if (nWorkers == 1) {
+      Routine();
+    } else {
+      auto& pool = WorkStealingPool::Instance(nWorkers);
+      for (size_t i = 0; i < nWorkers; ++i)
+        pool.Submit(i, [this] { Routine(); });
+      pool.Wait();
+    }
+
+    QuadratureResult res;
+    res.NEvals = NEvals;
+    res.NIntervals = Heap.size() + Final.size();
+
+    for (const auto& interval : Final) {
+      res.Value += interval.Value;
+      res.Error += interval.Error;
+    }
+
+    for (; !Heap.empty(); Heap.pop()) {
+      res.Value += Heap.top().Value;
+      res.Error += Heap.top().Error;
+    }
+
+    return res;
+  }
+};
+
+template <Integrand F>
+QuadratureResult IntegrateAdaptive(const F& func, double a, double b,
+                                   double prec, size_t nWorkers,
+                                   const AdaptiveQuadratureConfig& config = {}) {
+  return AdaptiveQuadrature<F>(func, prec, config).Run(a, b, nWorkers);
+}
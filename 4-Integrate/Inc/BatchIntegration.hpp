@@ -0,0 +1,208 @@
+#pragma once
+
+#include <Integration.hpp>
+#include <map>
+#include <tuple>
+
+struct BatchResult {
+  double Value = 0;
+  double Error = 0;
+};
+
+// Integrands sharing the interval, the precision and the grid resolution
+// are integrated over one grid with the smallest step of their StepEvals,
+// so every abscissa is computed once for all of the group members
+struct BatchGroup {
+  std::vector<size_t> Items;
+  std::vector<AdaptiveGrid::HomogenousPartition> Partitions;
+};
+
+// Items are grouped first, then one grid per group is built with the
+// combined StepEval, partitions of all groups at once on the pool
+inline std::vector<BatchGroup> MakeBatchGroups(
+    const std::vector<IntegrateArgs>& batch, WorkStealingPool& pool) {
+  using KeyT = std::tuple<double, double, double, size_t>;
+  std::map<KeyT, size_t> index;
+  std::vector<BatchGroup> groups;
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const auto& args = batch[i];
+    if (args.Engine != IntegrateEngine::Grid) continue;
+
+    KeyT key{args.A, args.B, args.Prec, args.GridResolution};
+    auto [it, inserted] = index.try_emplace(key, groups.size());
+    if (inserted) groups.emplace_back();
+
+    groups[it->second].Items.push_back(i);
+  }
+
+  // (group, partition) pairs
+  std::vector<std::pair<size_t, size_t>> parts;
+  for (size_t g = 0; g < groups.size(); ++g) {
+    size_t resolution = batch[groups[g].Items[0]].GridResolution;
+    groups[g].Partitions.resize(resolution);
+    for (size_t j = 0; j < resolution; ++j) parts.push_back({g, j});
+  }
+
+  pool.ParallelFor(parts.size(), [&](size_t begin, size_t end) {
+    for (size_t p = begin; p < end; ++p) {
+      auto [g, j] = parts[p];
+      auto& group = groups[g];
+      const auto& args = batch[group.Items[0]];
+
+      double partSize = (args.B - args.A) / group.Partitions.size();
+      auto& part = group.Partitions[j];
+      part.Start = args.A + partSize * j;
+      part.End = part.Start + partSize;
+
+      double h = INFINITY;
+      for (size_t item : group.Items)
+        h = std::min(h, batch[item].StepEval(batch[item].Func, part.Start,
+                                             partSize, args.Prec));
+
+      // Evenly quantize the interval
+      double steps = ceil(partSize / h);
+      part.Step = partSize / steps;
+      part.NSteps = steps;
+      part.StepCost = 1;
+    }
+  });
+
+  return groups;
+}
+
+// Composite Rule over nSteps steps for every function of the group:
+// out[m] = integral of funcs[m]
+template <QuadratureRule Rule>
+void IntegrateShared(const std::vector<AdaptiveGrid::FuncT>& funcs,
+                     double start, double h, size_t nSteps, double* out) {
+  alignas(64) double xs[IntegrateBatchSize];
+  alignas(64) double fs[IntegrateBatchSize];
+
+  struct NodeAcc {
+    double Sum[IntegrateNAccumulators] = {};
+  };
+
+  // acc[m * NNodes + k] accumulates funcs[m] values at node k
+  std::vector<NodeAcc> acc(funcs.size() * Rule::NNodes);
+
+  for (size_t done = 0; done < nSteps; done += IntegrateBatchSize) {
+    size_t n = std::min(IntegrateBatchSize, nSteps - done);
+
+    for (size_t k = 0; k < Rule::NNodes; ++k) {
+      double t = Rule::T[k];
+#pragma omp simd
+      for (size_t i = 0; i < n; ++i) xs[i] = start + (done + i + t) * h;
+
+      for (size_t m = 0; m < funcs.size(); ++m) {
+        EvalBatch(funcs[m], xs, fs, n);
+        Accumulate(acc[m * Rule::NNodes + k].Sum, fs, n);
+      }
+    }
+  }
+
+  for (size_t m = 0; m < funcs.size(); ++m) {
+    double sum = 0;
+    for (size_t k = 0; k < Rule::NNodes; ++k)
+      sum += Rule::W[k] * Reduce(acc[m * Rule::NNodes + k].Sum);
+    out[m] = h * sum;
+  }
+}
+
+// Integrates the whole batch on the shared pool:
+//  - Grid items are grouped (see BatchGroup), their partitions are split
+//    into ChunkSteps chunks, Error is the a priori StepEval bound, i.e.
+//    Prec per each of GridResolution partitions
+//  - Adaptive, Romberg and Oscillatory items are scheduled as
+//    single-threaded tasks, Error is the engine's a posteriori estimate
+template <QuadratureRule Rule>
+std::vector<BatchResult> IntegrateBatch(const std::vector<IntegrateArgs>& batch,
+                                        size_t nWorkers) {
+  assert(nWorkers != 0);
+
+  std::vector<BatchResult> results(batch.size());
+  auto& pool = WorkStealingPool::Instance(nWorkers);
+  auto groups = MakeBatchGroups(batch, pool);
+
+  struct Chunk {
+    size_t Group;
+    double Start;
+    double Step;
+    size_t NSteps;
+    size_t Offset;  // Of the chunk results in partials
+  };
+
+  std::vector<std::vector<AdaptiveGrid::FuncT>> funcs(groups.size());
+  std::vector<Chunk> chunks;
+  size_t nPartials = 0;
+
+  for (size_t g = 0; g < groups.size(); ++g) {
+    for (size_t item : groups[g].Items) funcs[g].push_back(batch[item].Func);
+
+    size_t chunkSteps = batch[groups[g].Items[0]].ChunkSteps;
+    for (const auto& part : groups[g].Partitions)
+      for (size_t done = 0; done < part.NSteps; done += chunkSteps) {
+        size_t nSteps = std::min(chunkSteps, part.NSteps - done);
+        chunks.push_back({g, part.Start + done * part.Step, part.Step, nSteps,
+                          nPartials});
+        nPartials += funcs[g].size();
+      }
+  }
+
+  std::vector<double> partials(nPartials, 0);
+
+  for (size_t i = 0; i < chunks.size(); ++i)
+    pool.Submit(i, [&, i] {
+      const auto& chunk = chunks[i];
+      IntegrateShared<Rule>(funcs[chunk.Group], chunk.Start, chunk.Step,
+                            chunk.NSteps, &partials[chunk.Offset]);
+    });
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (batch[i].Engine == IntegrateEngine::Adaptive)
+      pool.Submit(i, [&, i] {
+        const auto& args = batch[i];
+        AdaptiveQuadratureConfig config;
+        config.InitialIntervals = args.GridResolution;
+
+        auto res = IntegrateAdaptive(args.Func, args.A, args.B, args.Prec, 1,
+                                     config);
+        results[i] = {res.Value, res.Error};
+      });
+
+    if (batch[i].Engine == IntegrateEngine::Romberg)
+      pool.Submit(i, [&, i] {
+        const auto& args = batch[i];
+        RombergConfig config;
+        config.NPartitions =
+            std::max<size_t>(config.NPartitions, args.GridResolution);
+
+        RombergIntegrator romberg(args.Func, args.A, args.B, config);
+        auto res = romberg.Refine(args.Prec, 1);
+        results[i] = {res.Value, res.Error};
+      });
+
+    if (batch[i].Engine == IntegrateEngine::Oscillatory)
+      pool.Submit(i, [&, i] {
+        const auto& args = batch[i];
+        auto res = IntegrateOscillatory(args.Func, args.Subst, args.A, args.B,
+                                        args.Prec, 1);
+        results[i] = {res.Value, res.Error};
+      });
+  }
+
+  pool.Wait();
+
+  // Summed in chunk order, so results don't depend on the scheduling
+  for (const auto& chunk : chunks) {
+    const auto& items = groups[chunk.Group].Items;
+    for (size_t m = 0; m < items.size(); ++m)
+      results[items[m]].Value += partials[chunk.Offset + m];
+  }
+
+  for (const auto& group : groups)
+    for (size_t item : group.Items)
+      results[item].Error = batch[item].Prec * batch[item].GridResolution;
+
+  return results;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <mpi.h>
+
+#include <Common.hpp>
+#include <Integration.hpp>
+#include <QuasiMonteCarlo.hpp>
+#include <algorithm>
+
+// Flat representation of a partition: [Start, NParts, Step_0, NSteps_0, ...]
+void PackPartition(const AdaptiveGrid::HeterogenousPartition& part,
+                   std::vector<double>& buf) {
+  buf.push_back(part.Start);
+  buf.push_back(part.Parts.size());
+  for (const auto& interval : part.Parts) {
+    buf.push_back(interval.Step);
+    buf.push_back(interval.NSteps);
+  }
+}
+
+AdaptiveGrid::HeterogenousPartition UnpackPartition(const double* buf) {
+  AdaptiveGrid::HeterogenousPartition part;
+  part.Start = buf[0];
+  part.Parts.resize(buf[1]);
+
+  for (size_t i = 0; i < part.Parts.size(); ++i) {
+    part.Parts[i].Step = buf[2 + 2 * i];
+    part.Parts[i].NSteps = buf[3 + 2 * i];
+  }
+  return part;
+}
+
+size_t CountSteps(const AdaptiveGrid::HeterogenousPartition& part) {
+  size_t nSteps = 0;
+  for (const auto& interval : part.Parts) nSteps += interval.NSteps;
+  return nSteps;
+}
+
+struct RankReport {
+  double ComputeMs = 0;
+  size_t NSteps = 0;
+};
+
+void PrintRankReports(const std::vector<RankReport>& reports) {
+  double maxMs = 0;
+  double sumMs = 0;
+
+  for (size_t i = 0; i < reports.size(); ++i) {
+    std::cout << "Rank #" << i << ": " << reports[i].NSteps << " steps in "
+              << reports[i].ComputeMs << "ms" << std::endl;
+    maxMs = std::max(maxMs, reports[i].ComputeMs);
+    sumMs += reports[i].ComputeMs;
+  }
+
+  double avgMs = sumMs / reports.size();
+  std::cout << "Imbalance (max / avg - 1): "
+            << (avgMs > 0 ? maxMs / avgMs - 1 : 0) << std::endl;
+}
+
+// Root builds the grid with one partition per rank and scatters them,
+// each rank integrates its partition with nThreads pool workers and
+// the partial sums are reduced on the root.
+// Returns the integral value on the root and rank's partial sum elsewhere
+template <typename PartF>
+double IntegrateDistributed(const IntegrateArgs& args,
+                            const PartF& integratePart, size_t nThreads,
+                            bool report = true,
+                            const MPI::Intracomm& comm = MPI::COMM_WORLD) {
+  assert(nThreads != 0);
+  if (args.Engine != IntegrateEngine::Grid)
+    throw std::runtime_error("IntegrateDistributed: only Grid engine");
+
+  int size = comm.Get_size();
+  int rank = comm.Get_rank();
+
+  std::vector<double> packed;
+  std::vector<int> counts(size, 0);
+  std::vector<int> displs(size, 0);
+
+  if (rank == 0) {
+    auto grid = BuildGrid(args, size, nThreads);
+
+    for (int i = 0; i < size; ++i) {
+      displs[i] = packed.size();
+      PackPartition(grid.Partitions[i], packed);
+      counts[i] = packed.size() - displs[i];
+    }
+  }
+
+  int count = 0;
+  comm.Scatter(counts.data(), 1, MPI::INT, &count, 1, MPI::INT, 0);
+
+  std::vector<double> local(count);
+  comm.Scatterv(packed.data(), counts.data(), displs.data(), MPI::DOUBLE,
+                local.data(), count, MPI::DOUBLE, 0);
+
+  auto part = UnpackPartition(local.data());
+  RankReport self;
+  self.NSteps = CountSteps(part);
+
+  double start = MPI::Wtime();
+  double sum = 0;
+
+  if (nThreads == 1 || self.NSteps == 0) {
+    sum = integratePart(part);
+  } else {
+    AdaptiveGrid localGrid;
+    size_t pieceSteps = (self.NSteps + nThreads - 1) / nThreads;
+    localGrid.Partitions = SplitIntoChunks(part, pieceSteps);
+
+    auto& pool = WorkStealingPool::Instance(nThreads);
+    sum = IntegrateParallel(integratePart, localGrid, pool, args.ChunkSteps);
+  }
+
+  self.ComputeMs = (MPI::Wtime() - start) * 1000;
+
+  double total = 0;
+  comm.Reduce(&sum, &total, 1, MPI::DOUBLE, MPI::SUM, 0);
+
+  std::vector<RankReport> reports(rank == 0 ? size : 0);
+  static_assert(std::is_trivially_copyable_v<RankReport>);
+  comm.Gather(&self, sizeof(RankReport), MPI::BYTE, reports.data(),
+              sizeof(RankReport), MPI::BYTE, 0);
+
+  if (rank == 0 && report) PrintRankReports(reports);
+
+  return rank == 0 ? total : sum;
+}
+
+template <QuadratureRule Rule, Integrand F>
+double IntegrateDistributed(const IntegrateArgs& args, const F& func,
+                            size_t nThreads, bool report = true,
+                            const MPI::Intracomm& comm = MPI::COMM_WORLD) {
+  auto integratePart = [&](const AdaptiveGrid::HeterogenousPartition& part) {
+    return IntegratePart<Rule>(func, part);
+  };
+  return IntegrateDistributed(args, integratePart, nThreads, report, comm);
+}
+
+// Every rank takes a contiguous range of whole QMC blocks and integrates it
+// with nThreads pool workers, the per-shift sums are reduced on the root.
+// Valid result on the root only
+template <MultiIntegrand F>
+QmcResult IntegrateQmcDistributed(const F& func, const QmcBox& box,
+                                  const QmcConfig& config, size_t nThreads,
+                                  const MPI::Intracomm& comm = MPI::COMM_WORLD) {
+  assert(nThreads != 0);
+
+  uint64_t size = comm.Get_size();
+  uint64_t rank = comm.Get_rank();
+
+  uint64_t nBlocks =
+      (config.NPoints + config.BlockPoints - 1) / config.BlockPoints;
+  uint64_t begin = config.BlockPoints * (nBlocks * rank / size);
+  uint64_t end = std::min(config.NPoints,
+                          config.BlockPoints * (nBlocks * (rank + 1) / size));
+
+  auto sums = QmcPartialSums(func, box, config, begin, std::max(begin, end),
+                             nThreads);
+
+  std::vector<double> total(sums.size(), 0);
+  comm.Reduce(sums.data(), total.data(), sums.size(), MPI::DOUBLE, MPI::SUM,
+              0);
+
+  return rank == 0 ? QmcFinish(total, box, config) : QmcResult{};
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <AdaptiveGrid.hpp>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Everything the grid depends on. Id names the integrand together with its
+// StepEval (function addresses are not stable between runs), CostModel
+// names the step cost model the grid is split by
+struct GridKey {
+  std::string Id;
+  double A;
+  double B;
+  double Prec;
+  uint64_t Resolution;
+  uint64_t NWorkers;
+  std::string CostModel;
+
+  // FNV-1a over the fields
+  uint64_t Hash() const {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const void* data, size_t size) {
+      auto bytes = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+      }
+    };
+
+    mix(Id.data(), Id.size());
+    mix(&A, sizeof(A));
+    mix(&B, sizeof(B));
+    mix(&Prec, sizeof(Prec));
+    mix(&Resolution, sizeof(Resolution));
+    mix(&NWorkers, sizeof(NWorkers));
+    mix(CostModel.data(), CostModel.size());
+    return hash;
+  }
+
+  bool operator==(const GridKey& rhs) const = default;
+};
+
+// Binary layout, native endianness:
+//   Header, Id chars, CostModel chars (both zero-padded to 8 bytes),
+//   HomogenousPartition[NEven], PartitionRecord[NPartitions],
+//   HeterogenousPartition::Part[NParts]
+class GridSerializer final {
+ private:
+  static constexpr char Magic[8] = {'A', 'D', 'G', 'R', 'I', 'D', '0', '2'};
+
+  struct Header {
+    char Magic[8];
+    double A;
+    double B;
+    double Prec;
+    uint64_t Resolution;
+    uint64_t NWorkers;
+    uint64_t IdSize;
+    uint64_t CostModelSize;
+    uint64_t NEven;
+    uint64_t NPartitions;
+    uint64_t NParts;
+  };
+
+  struct PartitionRecord {
+    double Start;
+    uint64_t NParts;
+  };
+
+  using Part = AdaptiveGrid::HeterogenousPartition::Part;
+  using Even = AdaptiveGrid::HomogenousPartition;
+
+  static_assert(std::is_trivially_copyable_v<Part>);
+  static_assert(std::is_trivially_copyable_v<Even>);
+
+  template <typename T>
+  static void Put(std::ostream& out, const T* data, size_t count) {
+    out.write(reinterpret_cast<const char*>(data), sizeof(T) * count);
+  }
+
+  // Counts come from the file, so sizeof(T) * count may overflow
+  template <typename T>
+  static const T* Take(const char*& pos, const char* end, size_t count) {
+    if (count > size_t(end - pos) / sizeof(T))
+      throw std::runtime_error("GridSerializer: truncated data");
+    auto ptr = reinterpret_cast<const T*>(pos);
+    pos += sizeof(T) * count;
+    return ptr;
+  }
+
+  // Keeps the records following the strings aligned
+  static size_t PaddedSize(size_t size) { return (size + 7) / 8 * 8; }
+
+  static void PutString(std::ostream& out, const std::string& str) {
+    const char zeros[8] = {};
+    Put(out, str.data(), str.size());
+    Put(out, zeros, PaddedSize(str.size()) - str.size());
+  }
+
+  static std::string TakeString(const char*& pos, const char* end,
+                                uint64_t size) {
+    if (size > size_t(end - pos))
+      throw std::runtime_error("GridSerializer: truncated data");
+    return std::string(Take<char>(pos, end, PaddedSize(size)), size);
+  }
+
+ public:
+  static void Write(std::ostream& out, const GridKey& key,
+                    const AdaptiveGrid& grid) {
+    Header header{};
+    memcpy(header.Magic, Magic, sizeof(Magic));
+    header.A = key.A;
+    header.B = key.B;
+    header.Prec = key.Prec;
+    header.Resolution = key.Resolution;
+    header.NWorkers = key.NWorkers;
+    header.IdSize = key.Id.size();
+    header.CostModelSize = key.CostModel.size();
+    header.NEven = grid.EvenPartitions.size();
+    header.NPartitions = grid.Partitions.size();
+    for (const auto& part : grid.Partitions) header.NParts += part.Parts.size();
+
+    Put(out, &header, 1);
+    PutString(out, key.Id);
+    PutString(out, key.CostModel);
+    Put(out, grid.EvenPartitions.data(), grid.EvenPartitions.size());
+
+    for (const auto& part : grid.Partitions) {
+      PartitionRecord record{part.Start, part.Parts.size()};
+      Put(out, &record, 1);
+    }
+
+    for (const auto& part : grid.Partitions)
+      Put(out, part.Parts.data(), part.Parts.size());
+  }
+
+  // Throws on malformed data or on the key mismatch
+  static AdaptiveGrid Read(const char* data, size_t size,
+                           const GridKey& key) {
+    const char* pos = data;
+    const char* end = data + size;
+
+    Header header = *Take<Header>(pos, end, 1);
+    if (memcmp(header.Magic, Magic, sizeof(Magic)) != 0)
+      throw std::runtime_error("GridSerializer: bad magic");
+
+    std::string id = TakeString(pos, end, header.IdSize);
+    std::string costModel = TakeString(pos, end, header.CostModelSize);
+    GridKey stored{id,          header.A,          header.B,
+                   header.Prec, header.Resolution, header.NWorkers,
+                   costModel};
+    if (!(stored == key))
+      throw std::runtime_error("GridSerializer: key mismatch");
+
+    // Records should take exactly the rest of the data. Every product is
+    // at most left, so the sum doesn't overflow
+    size_t left = end - pos;
+    if (header.NEven > left / sizeof(Even) ||
+        header.NPartitions > left / sizeof(PartitionRecord) ||
+        header.NParts > left / sizeof(Part) ||
+        header.NEven * sizeof(Even) +
+                header.NPartitions * sizeof(PartitionRecord) +
+                header.NParts * sizeof(Part) !=
+            left)
+      throw std::runtime_error("GridSerializer: counts don't match the size");
+
+    AdaptiveGrid grid;
+
+    const Even* even = Take<Even>(pos, end, header.NEven);
+    grid.EvenPartitions.assign(even, even + header.NEven);
+
+    const PartitionRecord* records =
+        Take<PartitionRecord>(pos, end, header.NPartitions);
+    const Part* parts = Take<Part>(pos, end, header.NParts);
+
+    grid.Partitions.resize(header.NPartitions);
+    uint64_t used = 0;
+
+    for (size_t i = 0; i < header.NPartitions; ++i) {
+      if (records[i].NParts > header.NParts - used)
+        throw std::runtime_error("GridSerializer: bad partition record");
+
+      grid.Partitions[i].Start = records[i].Start;
+      grid.Partitions[i].Parts.assign(parts + used,
+                                      parts + used + records[i].NParts);
+      used += records[i].NParts;
+    }
+
+    return grid;
+  }
+};
+
+// Content-addressed directory of grids: <Dir>/<hash of the key>.grid
+class GridCache final {
+ private:
+  std::filesystem::path Dir;
+
+  // Read-only mapping of the whole file, parsed in place
+  class Mapping final {
+   private:
+    void* Data = MAP_FAILED;
+    size_t Size = 0;
+
+   public:
+    explicit Mapping(const std::filesystem::path& path) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) return;
+
+      struct stat st = {};
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        Size = st.st_size;
+        Data = mmap(nullptr, Size, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+      close(fd);
+    }
+
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    ~Mapping() {
+      if (Data != MAP_FAILED) munmap(Data, Size);
+    }
+
+    bool Valid() const { return Data != MAP_FAILED; }
+    const char* Get() const { return static_cast<const char*>(Data); }
+    size_t GetSize() const { return Size; }
+  };
+
+ public:
+  explicit GridCache(const std::string& dir) : Dir{dir} {}
+
+  std::filesystem::path PathFor(const GridKey& key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.grid",
+             static_cast<unsigned long long>(key.Hash()));
+    return Dir / name;
+  }
+
+  // Empty on miss or on a corrupted entry
+  std::optional<AdaptiveGrid> Load(const GridKey& key) const {
+    Mapping file(PathFor(key));
+    if (!file.Valid()) return std::nullopt;
+
+    try {
+      return GridSerializer::Read(file.Get(), file.GetSize(), key);
+    } catch (std::exception& e) {
+      std::cerr << "Grid cache: " << PathFor(key) << ": " << e.what()
+                << std::endl;
+      return std::nullopt;
+    }
+  }
+
+  // Written to a temporary file first, so readers never see partial grids.
+  // Throws on failure, the temporary file is removed
+  void Store(const GridKey& key, const AdaptiveGrid& grid) const {
+    auto path = PathFor(key);
+    auto tmp = path;
+    tmp += "." + std::to_string(getpid()) + ".tmp";
+
+    try {
+      std::filesystem::create_directories(Dir);
+
+      {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        GridSerializer::Write(out, key, grid);
+        if (!out)
+          throw std::runtime_error("failed to write " + tmp.string());
+      }
+
+      std::filesystem::rename(tmp, path);
+    } catch (...) {
+      std::error_code ec;
+      std::filesystem::remove(tmp, ec);
+      throw;
+    }
+  }
+};
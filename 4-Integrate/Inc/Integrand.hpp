@@ -0,0 +1,58 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+
+// Batch form of an integrand: out[i] = f(x[i]), i < n
+template <typename F>
+concept BatchIntegrand = requires(const F& f, const double* x, double* out,
+                                  size_t n) { f(x, out, n); };
+
+template <typename F>
+concept ScalarIntegrand = requires(const F& f, double x) {
+  { f(x) } -> std::convertible_to<double>;
+};
+
+template <typename F>
+concept Integrand = BatchIntegrand<F> || ScalarIntegrand<F>;
+
+template <Integrand F>
+inline void EvalBatch(const F& func, const double* x, double* out, size_t n) {
+  if constexpr (BatchIntegrand<F>) {
+    func(x, out, n);
+  } else {
+#pragma omp simd
+    for (size_t i = 0; i < n; ++i) out[i] = func(x[i]);
+  }
+}
+
+// Flops per evaluation, F::Flops if the integrand declares it, 0 otherwise
+template <Integrand F>
+constexpr double IntegrandFlops() {
+  if constexpr (requires { F::Flops; })
+    return F::Flops;
+  else
+    return 0;
+}
+
+static constexpr size_t IntegrateBatchSize = 256;
+static constexpr size_t IntegrateNAccumulators = 8;
+
+// Sums n values into independent accumulators to break the add dependency
+inline void Accumulate(double (&acc)[IntegrateNAccumulators], const double* vals,
+                       size_t n) {
+  constexpr size_t k = IntegrateNAccumulators;
+  size_t i = 0;
+
+  for (; i + k <= n; i += k)
+#pragma omp simd
+    for (size_t j = 0; j < k; ++j) acc[j] += vals[i + j];
+
+  for (; i < n; ++i) acc[i % k] += vals[i];
+}
+
+inline double Reduce(const double (&acc)[IntegrateNAccumulators]) {
+  double sum = 0;
+  for (double val : acc) sum += val;
+  return sum;
+}
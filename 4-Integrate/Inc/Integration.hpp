@@ -1,99 +1,258 @@
 #pragma once
 
 #include <AdaptiveGrid.hpp>
+#include <AdaptiveQuadrature.hpp>
+#include <GridCache.hpp>
+#include <Instrumentation.hpp>
+#include <Integrand.hpp>
+#include <Oscillatory.hpp>
+#include <QuadratureRules.hpp>
+#include <Reduction.hpp>
+#include <Romberg.hpp>
+#include <ThreadPool.hpp>
+#include <Trace.hpp>
+#include <algorithm>
 #include <cstring>
-#include <mutex>
 #include <numeric>
-#include <thread>
 
-timespec GetTimespec(clockid_t cid = CLOCK_REALTIME) {
-  timespec ts = {};
-  if (clock_gettime(cid, &ts) < 0)
-    throw std::runtime_error(std::string("clock_gettime: ") + strerror(errno));
-  return ts;
+inline size_t PartSteps(const AdaptiveGrid::HeterogenousPartition& part) {
+  size_t nSteps = 0;
+  for (const auto& interval : part.Parts) nSteps += interval.NSteps;
+  return nSteps;
 }
 
-// ts2 >= ts1
-timespec GetTimeDiff(timespec ts1, timespec ts2) {
-  timespec tsd = {};
-  if (ts1.tv_sec > ts2.tv_sec ||
-      (ts1.tv_sec == ts2.tv_sec && ts1.tv_nsec > ts2.tv_nsec))
-    throw std::runtime_error("GetTimeDiff: wrong order");
+// Rule per step: h*f(x) + h^2/2*f'(x), h is factored out of the sums
+template <Integrand F, Integrand FD>
+double IntegratePart(const F& func, const FD& funcd,
+                     const AdaptiveGrid::HeterogenousPartition& part) {
+  // Per step: 2 flops of the abscissa and 1 per accumulation, xs is stored
+  // once and loaded by both integrands, fs is stored and loaded twice
+  size_t nSteps = PartSteps(part);
+  double flops = 4 + IntegrandFlops<F>() + IntegrandFlops<FD>();
+  double bytes = 7 * sizeof(double);
 
-  tsd.tv_sec = ts2.tv_sec - ts1.tv_sec;
-  tsd.tv_nsec = ts2.tv_nsec - ts1.tv_nsec;
+  static const RegionHandle region{"IntegratePart"};
+  ScopedRegion _(region, 2 * nSteps, nSteps * flops, nSteps * bytes);
 
-  if (tsd.tv_nsec < 0) {
-    tsd.tv_sec--;
-    tsd.tv_nsec += 1000000000;
-  }
+  alignas(64) double xs[IntegrateBatchSize];
+  alignas(64) double fs[IntegrateBatchSize];
 
-  return tsd;
-}
+  double sum = 0;
+  double pos = part.Start;
+
+  for (const auto& interval : part.Parts) {
+    double h = interval.Step;
+    double fsum[IntegrateNAccumulators] = {};
+    double fdsum[IntegrateNAccumulators] = {};
+
+    for (size_t done = 0; done < interval.NSteps; done += IntegrateBatchSize) {
+      size_t n = std::min(IntegrateBatchSize, interval.NSteps - done);
+
+#pragma omp simd
+      for (size_t i = 0; i < n; ++i) xs[i] = pos + (done + i) * h;
+
+      EvalBatch(func, xs, fs, n);
+      Accumulate(fsum, fs, n);
 
-double Timespec2Ms(timespec ts) {
-  double ms = ts.tv_sec * 1000 + float(ts.tv_nsec) / (1000 * 1000);
-  return ms;
+      EvalBatch(funcd, xs, fs, n);
+      Accumulate(fdsum, fs, n);
+    }
+
+    pos += interval.NSteps * h;
+    sum += h * Reduce(fsum) + (h * h / 2) * Reduce(fdsum);
+  }
+
+  return sum;
 }
 
-double IntegratePart(AdaptiveGrid::FuncT func, AdaptiveGrid::FuncT funcd,
+// Composite Rule over the partition, nodes of the same index are evaluated
+// as one batch for IntegrateBatchSize consecutive steps
+template <QuadratureRule Rule, Integrand F>
+double IntegratePart(const F& func,
                      const AdaptiveGrid::HeterogenousPartition& part) {
+  alignas(64) double xs[IntegrateBatchSize];
+  alignas(64) double fs[IntegrateBatchSize];
+
+  // Right border node of step i is the left one of step i + 1
+  constexpr bool shared = SharesBorders<Rule>;
+  constexpr size_t nNodes = shared ? Rule::NNodes - 1 : Rule::NNodes;
+
+  // Per node: 3 flops of the abscissa and 1 of the accumulation, xs and
+  // fs are stored and loaded once
+  size_t nEvals = nNodes * PartSteps(part);
+  double flops = 4 + IntegrandFlops<F>();
+  double bytes = 4 * sizeof(double);
+
+  static const RegionHandle region{"IntegratePart"};
+  ScopedRegion _(region, nEvals, nEvals * flops, nEvals * bytes);
+
   double sum = 0;
   double pos = part.Start;
 
   for (const auto& interval : part.Parts) {
     double h = interval.Step;
-    double fsum = 0;
-    double fdsum = 0;
+    double nodeSum[nNodes][IntegrateNAccumulators] = {};
 
-    for (int i = 0; i < interval.NSteps; ++i) {
-      double x = pos + i * h;
-      fsum += h * func(x);
-      fdsum += (h * h / 2) * funcd(x);
+    for (size_t done = 0; done < interval.NSteps; done += IntegrateBatchSize) {
+      size_t n = std::min(IntegrateBatchSize, interval.NSteps - done);
+
+      for (size_t k = 0; k < nNodes; ++k) {
+        double t = Rule::T[k];
+#pragma omp simd
+        for (size_t i = 0; i < n; ++i) xs[i] = pos + (done + i + t) * h;
+
+        EvalBatch(func, xs, fs, n);
+        Accumulate(nodeSum[k], fs, n);
+      }
     }
 
-    pos += interval.NSteps * h;
-    sum += fsum + fdsum;
+    double isum = 0;
+    for (size_t k = 0; k < nNodes; ++k) isum += Rule::W[k] * Reduce(nodeSum[k]);
+
+    double end = pos + interval.NSteps * h;
+
+    if constexpr (shared) {
+      // Sum of left borders doubles as the sum of right borders, except for
+      // the very first and the very last nodes
+      double borders[2] = {pos, end};
+      double fBorders[2];
+      EvalBatch(func, borders, fBorders, 2);
+
+      double wRight = Rule::W[Rule::NNodes - 1];
+      isum += wRight * (Reduce(nodeSum[0]) + fBorders[1] - fBorders[0]);
+    }
+
+    pos = end;
+    sum += h * isum;
   }
 
   return sum;
 }
 
-void IntegratePartWrapper(AdaptiveGrid::FuncT func, AdaptiveGrid::FuncT funcd,
-                          const AdaptiveGrid::HeterogenousPartition& part,
-                          double& result, std::mutex& mutex) {
-  auto start = GetTimespec();
-  result = IntegratePart(func, funcd, part);
-  auto end = GetTimespec();
+// Splits partition into independent chunks of at most chunkSteps steps
+std::vector<AdaptiveGrid::HeterogenousPartition> SplitIntoChunks(
+    const AdaptiveGrid::HeterogenousPartition& part, size_t chunkSteps) {
+  assert(chunkSteps);
 
-  auto diff = GetTimeDiff(start, end);
-  double ms = Timespec2Ms(diff);
+  std::vector<AdaptiveGrid::HeterogenousPartition> chunks;
+  double pos = part.Start;
 
-  std::lock_guard<std::mutex> _(mutex);
+  for (const auto& interval : part.Parts) {
+    for (size_t done = 0; done < interval.NSteps; done += chunkSteps) {
+      size_t nSteps = std::min(chunkSteps, interval.NSteps - done);
+      chunks.push_back({pos + done * interval.Step, {{interval.Step, nSteps}}});
+    }
+    pos += interval.NSteps * interval.Step;
+  }
 
-  std::cout << "Thread @" << part.Start << " finished in "
-            << round(ms / 100) / 10 << "s" << std::endl;
+  return chunks;
 }
 
-double IntegrateParallel(AdaptiveGrid::FuncT func, AdaptiveGrid::FuncT funcd,
-                         const AdaptiveGrid& grid, size_t nWorkers) {
-  std::vector<double> results(nWorkers, 42);
-  std::vector<std::thread> workers;
-  std::mutex mutex;
+void PrintPoolStats(const WorkStealingPool& pool) {
+  for (size_t i = 0; i < pool.Size(); ++i) {
+    const auto& stats = pool.Stats(i);
+    std::cout << "Thread #" << i << " busy for "
+              << round(stats.BusyMs / 100) / 10 << "s, " << stats.NTasks
+              << " chunks (" << stats.NStolen << " stolen)" << std::endl;
+  }
+}
 
-  for (int i = 0; i < nWorkers; ++i)
-    workers.emplace_back(IntegratePartWrapper, func, funcd,
-                         std::cref(grid.Partitions[i]), std::ref(results[i]), std::ref(mutex));
+struct GridChunks {
+  std::vector<AdaptiveGrid::HeterogenousPartition> Chunks;
+  std::vector<size_t> Owners;  // Worker the chunk is initially queued to
+};
 
-  for (auto& worker : workers) worker.join();
+// Chunks are cut from the even partitions, which don't depend on nWorkers,
+// and are queued to workers by equal shares of the cumulative cost. Grids
+// without even partitions (pieces of a distributed grid) are cut from
+// Partitions, chunks of partition i are queued to worker i
+GridChunks SplitGrid(const AdaptiveGrid& grid, size_t chunkSteps,
+                     size_t nWorkers) {
+  GridChunks res;
 
-  double sum = 0;
-  for (auto res : results) sum += res;
+  if (grid.EvenPartitions.empty()) {
+    for (size_t i = 0; i < grid.Partitions.size(); ++i) {
+      auto split = SplitIntoChunks(grid.Partitions[i], chunkSteps);
+      res.Chunks.insert(res.Chunks.end(), split.begin(), split.end());
+      res.Owners.insert(res.Owners.end(), split.size(), i % nWorkers);
+    }
+    return res;
+  }
 
-  return sum;
+  std::vector<double> costs;
+  double totalCost = 0;
+
+  for (const auto& part : grid.EvenPartitions)
+    for (size_t done = 0; done < part.NSteps; done += chunkSteps) {
+      size_t nSteps = std::min(chunkSteps, part.NSteps - done);
+      res.Chunks.push_back({part.Start + done * part.Step, {{part.Step, nSteps}}});
+      costs.push_back(nSteps * part.StepCost);
+      totalCost += costs.back();
+    }
+
+  double prefix = 0;
+  for (double cost : costs) {
+    size_t owner = totalCost > 0 ? prefix * nWorkers / totalCost : 0;
+    res.Owners.push_back(std::min(owner, nWorkers - 1));
+    prefix += cost;
+  }
+
+  return res;
+}
+
+// Chunks are balanced by stealing, their results are tree-reduced in
+// chunk order, so the sum is bit-identical for any pool size
+template <typename PartF>
+double IntegrateParallel(const PartF& integratePart, const AdaptiveGrid& grid,
+                         WorkStealingPool& pool, size_t chunkSteps) {
+  auto [chunks, owners] = SplitGrid(grid, chunkSteps, pool.Size());
+
+  // Result of chunk i is in slot slots[i] of its owner's block. Blocks are
+  // first-touched by their workers, slots of chunks finishing at the same
+  // time don't share cache lines
+  std::vector<size_t> sizes(pool.Size(), 0);
+  std::vector<size_t> slots(chunks.size());
+  for (size_t i = 0; i < chunks.size(); ++i) slots[i] = sizes[owners[i]]++;
+
+  PerWorkerSlots<double> results(pool, sizes);
+
+  pool.ResetStats();
+  for (size_t i = 0; i < chunks.size(); ++i)
+    pool.Submit(owners[i], [&, i] {
+      TraceEvent("chunk begin", i, chunks[i].Start);
+      double& res = results.At(owners[i], slots[i]);
+      res = integratePart(chunks[i]);
+      TraceEvent("chunk end", i, res);
+    });
+  pool.Wait();
+
+  std::vector<double> sums(chunks.size());
+  for (size_t i = 0; i < chunks.size(); ++i)
+    sums[i] = results.At(owners[i], slots[i]);
+
+  return TreeReduce(sums);
+}
+
+template <Integrand F, Integrand FD>
+double IntegrateParallel(const F& func, const FD& funcd,
+                         const AdaptiveGrid& grid, WorkStealingPool& pool,
+                         size_t chunkSteps) {
+  auto integratePart = [&](const AdaptiveGrid::HeterogenousPartition& part) {
+    return IntegratePart(func, funcd, part);
+  };
+  return IntegrateParallel(integratePart, grid, pool, chunkSteps);
 }
 
+enum class IntegrateEngine {
+  Grid,     // A priori AdaptiveGrid built with StepEval
+  Adaptive,  // A posteriori Gauss-Kronrod bisection, StepEval is unused
+  Romberg,   // Progressive refinement with extrapolation, StepEval is unused
+  Oscillatory  // Gauss-Kronrod over the lobes after Substitution
+};
+
 struct IntegrateArgs {
+  IntegrateEngine Engine = IntegrateEngine::Grid;
+
   AdaptiveGrid::FuncT Func;
   AdaptiveGrid::FuncT FuncD;
   AdaptiveGrid::StepEvalT StepEval;
@@ -103,21 +262,182 @@ struct IntegrateArgs {
   double Prec;
 
   double GridResolution = 1;
+
+  // Used by the Oscillatory engine only
+  Substitution Subst;
+
+  // NThreads == 0 means building the grid with nWorkers threads
+  AdaptiveGrid::BuildConfig GridBuild = {.NThreads = 0};
+
+  // Grids are cached in GridCacheDir if both are set. Id should identify
+  // Func together with StepEval and GridBuild cost model
+  std::string Id;
+  std::string GridCacheDir;
+
+  // Granularity of the work available for stealing
+  size_t ChunkSteps = 1 << 16;
 };
 
-double Integrate(const IntegrateArgs& args, size_t nWorkers,
-                 bool dumpGrid = false) {
-  assert(nWorkers != 0);
+// Part of the grid cache key: CostEval is identified by Id, measured costs
+// by the number of samples
+inline std::string GridCostModel(const AdaptiveGrid::BuildConfig& build) {
+  if (build.CostEval) return "eval";
+  if (build.CostSamples)
+    return "measured:" + std::to_string(build.CostSamples) +
+           (build.CostFunc ? ":batch" : ":scalar");
+  return "uniform";
+}
+
+// Grid with nWorkers partitions, built with nThreads unless GridBuild
+// says otherwise or the grid is found in the cache
+AdaptiveGrid BuildGrid(const IntegrateArgs& args, size_t nWorkers,
+                       size_t nThreads) {
+  bool cached = !args.Id.empty() && !args.GridCacheDir.empty();
+  GridKey key{args.Id,   args.A,
+              args.B,    args.Prec,
+              size_t(args.GridResolution), nWorkers,
+              GridCostModel(args.GridBuild)};
+
+  if (cached)
+    if (auto grid = GridCache(args.GridCacheDir).Load(key)) return *grid;
+
+  auto build = args.GridBuild;
+  if (build.NThreads == 0) build.NThreads = nThreads;
+
+  auto grid =
+      AdaptiveGrid::Create(args.StepEval, args.Func, args.A, args.B, args.Prec,
+                           nWorkers, args.GridResolution, build);
+
+  // The integral is already computable, a read-only or full cache directory
+  // shouldn't abort it (nor leave other ranks waiting for this one)
+  if (cached) try {
+      GridCache(args.GridCacheDir).Store(key, grid);
+    } catch (std::exception& e) {
+      std::cerr << "Grid cache: " << e.what() << ", continuing uncached"
+                << std::endl;
+    }
+
+  return grid;
+}
+
+template <Integrand F>
+double IntegrateAdaptive(const IntegrateArgs& args, const F& func,
+                         size_t nWorkers, bool dumpGrid) {
+  AdaptiveQuadratureConfig config;
+  config.InitialIntervals = std::max<size_t>(args.GridResolution, nWorkers);
+
+  auto res =
+      IntegrateAdaptive(func, args.A, args.B, args.Prec, nWorkers, config);
+
+  if (dumpGrid)
+    std::cout << "Adaptive quadrature: " << res.NIntervals << " intervals, "
+              << res.NEvals << " evaluations, error estimate " << res.Error
+              << std::endl;
+
+  return res.Value;
+}
+
+// Partitions don't depend on nWorkers, so neither does the result
+template <Integrand F>
+double IntegrateRomberg(const IntegrateArgs& args, const F& func,
+                        size_t nWorkers, bool dumpGrid) {
+  RombergConfig config;
+  config.NPartitions =
+      std::max<size_t>(config.NPartitions, args.GridResolution);
+
+  RombergIntegrator<F> romberg(func, args.A, args.B, config);
+  auto res = romberg.Refine(args.Prec, nWorkers);
 
-  auto grid = AdaptiveGrid::Create(args.StepEval, args.Func, args.A, args.B,
-                                   args.Prec, nWorkers, args.GridResolution);
+  if (dumpGrid)
+    std::cout << "Romberg: " << res.NIntervals << " partitions, "
+              << res.NEvals << " evaluations, error estimate " << res.Error
+              << std::endl;
+
+  return res.Value;
+}
+
+template <Integrand F>
+double IntegrateOscillatory(const IntegrateArgs& args, const F& func,
+                            size_t nWorkers, bool dumpGrid) {
+  if (args.Subst.Empty())
+    throw std::runtime_error("IntegrateOscillatory: no substitution");
+
+  auto res = IntegrateOscillatory(func, args.Subst, args.A, args.B, args.Prec,
+                                  nWorkers);
+
+  if (dumpGrid)
+    std::cout << "Oscillatory quadrature: " << res.NIntervals
+              << " intervals, " << res.NEvals << " evaluations, error estimate "
+              << res.Error << std::endl;
+
+  return res.Value;
+}
+
+template <typename PartF>
+double IntegrateOnGrid(const IntegrateArgs& args, const PartF& integratePart,
+                       size_t nWorkers, bool dumpGrid) {
+  auto grid = BuildGrid(args, nWorkers, nWorkers);
 
   if (dumpGrid) grid.Dump();
 
   assert(grid.Partitions.size() == nWorkers);
 
-  if (nWorkers == 1)
-    return IntegratePart(args.Func, args.FuncD, grid.Partitions[0]);
+  if (nWorkers == 1) {  // Same chunks and order as the parallel run
+    auto [chunks, _] = SplitGrid(grid, args.ChunkSteps, 1);
+
+    std::vector<double> sums;
+    for (const auto& chunk : chunks) sums.push_back(integratePart(chunk));
+    return TreeReduce(sums);
+  }
+
+  auto& pool = WorkStealingPool::Instance(nWorkers);
+  double res = IntegrateParallel(integratePart, grid, pool, args.ChunkSteps);
+
+  if (dumpGrid) PrintPoolStats(pool);
+  return res;
+}
+
+// Func is still used by StepEval, while the integrated callables may be
+// any (possibly batch) Integrand
+template <Integrand F, Integrand FD>
+double Integrate(const IntegrateArgs& args, const F& func, const FD& funcd,
+                 size_t nWorkers, bool dumpGrid = false) {
+  assert(nWorkers != 0);
+
+  if (args.Engine == IntegrateEngine::Adaptive)
+    return IntegrateAdaptive(args, func, nWorkers, dumpGrid);
+  if (args.Engine == IntegrateEngine::Romberg)
+    return IntegrateRomberg(args, func, nWorkers, dumpGrid);
+  if (args.Engine == IntegrateEngine::Oscillatory)
+    return IntegrateOscillatory(args, func, nWorkers, dumpGrid);
 
-  return IntegrateParallel(args.Func, args.FuncD, grid, nWorkers);
+  auto integratePart = [&](const AdaptiveGrid::HeterogenousPartition& part) {
+    return IntegratePart(func, funcd, part);
+  };
+  return IntegrateOnGrid(args, integratePart, nWorkers, dumpGrid);
+}
+
+// Same with a composite Rule, StepEval should provide the Rule precision
+// (see RuleStep), FuncD is unused
+template <QuadratureRule Rule, Integrand F>
+double Integrate(const IntegrateArgs& args, const F& func, size_t nWorkers,
+                 bool dumpGrid = false) {
+  assert(nWorkers != 0);
+
+  if (args.Engine == IntegrateEngine::Adaptive)
+    return IntegrateAdaptive(args, func, nWorkers, dumpGrid);
+  if (args.Engine == IntegrateEngine::Romberg)
+    return IntegrateRomberg(args, func, nWorkers, dumpGrid);
+  if (args.Engine == IntegrateEngine::Oscillatory)
+    return IntegrateOscillatory(args, func, nWorkers, dumpGrid);
+
+  auto integratePart = [&](const AdaptiveGrid::HeterogenousPartition& part) {
+    return IntegratePart<Rule>(func, part);
+  };
+  return IntegrateOnGrid(args, integratePart, nWorkers, dumpGrid);
+}
+
+double Integrate(const IntegrateArgs& args, size_t nWorkers,
+                 bool dumpGrid = false) {
+  return Integrate(args, args.Func, args.FuncD, nWorkers, dumpGrid);
 }
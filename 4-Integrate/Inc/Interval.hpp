@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numbers>
+
+// Closed interval [Lo, Hi] enclosing every value the expression may take.
+// Bounds are rounded outwards by one ulp after every operation (two for
+// the libm functions, which are not correctly rounded), so enclosures
+// stay rigorous without switching the FPU rounding mode
+struct Interval {
+  double Lo = 0;
+  double Hi = 0;
+
+  Interval() = default;
+  Interval(double val) : Lo{val}, Hi{val} {}
+  Interval(double lo, double hi) : Lo{lo}, Hi{hi} {}
+
+  static Interval Entire() {
+    constexpr double inf = std::numeric_limits<double>::infinity();
+    return {-inf, inf};
+  }
+
+  static double Down(double val, unsigned ulps = 1) {
+    for (unsigned i = 0; i < ulps; ++i)
+      val = std::nextafter(val, -std::numeric_limits<double>::infinity());
+    return val;
+  }
+
+  static double Up(double val, unsigned ulps = 1) {
+    for (unsigned i = 0; i < ulps; ++i)
+      val = std::nextafter(val, std::numeric_limits<double>::infinity());
+    return val;
+  }
+
+  static Interval Outward(double lo, double hi, unsigned ulps = 1) {
+    return {Down(lo, ulps), Up(hi, ulps)};
+  }
+
+  bool Contains(double val) const { return Lo <= val && val <= Hi; }
+
+  // max |x| over the interval
+  double Mag() const { return std::max(std::fabs(Lo), std::fabs(Hi)); }
+
+  double Width() const { return Hi - Lo; }
+};
+
+inline Interval operator+(const Interval& lhs, const Interval& rhs) {
+  return Interval::Outward(lhs.Lo + rhs.Lo, lhs.Hi + rhs.Hi);
+}
+
+inline Interval operator-(const Interval& lhs, const Interval& rhs) {
+  return Interval::Outward(lhs.Lo - rhs.Hi, lhs.Hi - rhs.Lo);
+}
+
+inline Interval operator-(const Interval& val) { return {-val.Hi, -val.Lo}; }
+
+inline Interval operator*(const Interval& lhs, const Interval& rhs) {
+  double p[4] = {lhs.Lo * rhs.Lo, lhs.Lo * rhs.Hi, lhs.Hi * rhs.Lo,
+                 lhs.Hi * rhs.Hi};
+  return Interval::Outward(*std::min_element(p, p + 4),
+                           *std::max_element(p, p + 4));
+}
+
+inline Interval operator/(const Interval& lhs, const Interval& rhs) {
+  if (rhs.Contains(0)) return Interval::Entire();
+  return lhs * Interval::Outward(1 / rhs.Hi, 1 / rhs.Lo);
+}
+
+inline Interval& operator+=(Interval& lhs, const Interval& rhs) {
+  return lhs = lhs + rhs;
+}
+
+inline Interval& operator-=(Interval& lhs, const Interval& rhs) {
+  return lhs = lhs - rhs;
+}
+
+// Does [lo, hi] contain phase + 2 pi k for some integer k? Errs on the
+// side of "yes", which only widens the result
+inline bool ContainsPhase(double lo, double hi, double phase) {
+  constexpr double period = 2 * std::numbers::pi;
+  double k = std::ceil((lo - phase) / period - 1e-9);
+  return phase + k * period <= hi + 1e-9 * std::max(1., std::fabs(hi));
+}
+
+inline Interval sin(const Interval& val) {
+  constexpr double pi = std::numbers::pi;
+  if (val.Width() >= 2 * pi) return {-1, 1};
+
+  double a = std::sin(val.Lo);
+  double b = std::sin(val.Hi);
+  Interval res = Interval::Outward(std::min(a, b), std::max(a, b), 2);
+
+  if (ContainsPhase(val.Lo, val.Hi, pi / 2)) res.Hi = 1;
+  if (ContainsPhase(val.Lo, val.Hi, -pi / 2)) res.Lo = -1;
+
+  return {std::max(res.Lo, -1.), std::min(res.Hi, 1.)};
+}
+
+inline Interval cos(const Interval& val) {
+  constexpr double pi = std::numbers::pi;
+  if (val.Width() >= 2 * pi) return {-1, 1};
+
+  double a = std::cos(val.Lo);
+  double b = std::cos(val.Hi);
+  Interval res = Interval::Outward(std::min(a, b), std::max(a, b), 2);
+
+  if (ContainsPhase(val.Lo, val.Hi, 0)) res.Hi = 1;
+  if (ContainsPhase(val.Lo, val.Hi, pi)) res.Lo = -1;
+
+  return {std::max(res.Lo, -1.), std::min(res.Hi, 1.)};
+}
+
+inline Interval exp(const Interval& val) {
+  return Interval::Outward(std::exp(val.Lo), std::exp(val.Hi), 2);
+}
+
+inline Interval log(const Interval& val) {
+  if (val.Lo <= 0) return Interval::Entire();
+  return Interval::Outward(std::log(val.Lo), std::log(val.Hi), 2);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <AdaptiveQuadrature.hpp>
+#include <Integrand.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+// Monotone change of variables x = X(u), U is the inverse of X.
+// HalfPeriod > 0 marks the integrand as oscillating with a constant
+// half-period in u: the u domain is split at its multiples, so every piece
+// holds a single lobe that Gauss-Kronrod integrates in one or two bisections
+struct Substitution {
+  using FuncT = double (*)(double);
+
+  FuncT X = nullptr;
+  FuncT Jacobian = nullptr;  // dX/du
+  FuncT U = nullptr;
+  double HalfPeriod = 0;
+
+  bool Empty() const { return X == nullptr; }
+};
+
+// f(X(u)) * |X'(u)| in the batch form
+template <Integrand F>
+class SubstitutedIntegrand final {
+ private:
+  const F& Func;
+  const Substitution& Subst;
+
+ public:
+  SubstitutedIntegrand(const F& func, const Substitution& subst)
+      : Func{func}, Subst{subst} {}
+
+  void operator()(const double* u, double* out, size_t n) const {
+    alignas(64) double xs[IntegrateBatchSize];
+
+    for (size_t done = 0; done < n; done += IntegrateBatchSize) {
+      size_t count = std::min(IntegrateBatchSize, n - done);
+
+      for (size_t i = 0; i < count; ++i) xs[i] = Subst.X(u[done + i]);
+      EvalBatch(Func, xs, out + done, count);
+
+      for (size_t i = 0; i < count; ++i)
+        out[done + i] *= fabs(Subst.Jacobian(u[done + i]));
+    }
+  }
+};
+
+// Borders of the lobes of [uA, uB]: multiples of halfPeriod between them
+inline std::vector<double> SplitLobes(double uA, double uB, double halfPeriod,
+                                      size_t maxPieces) {
+  std::vector<double> borders = {uA};
+
+  if (halfPeriod > 0) {
+    double first = std::floor(uA / halfPeriod) + 1;
+    double last = std::ceil(uB / halfPeriod) - 1;
+
+    if (last - first + 2 > double(maxPieces))
+      throw std::runtime_error("SplitLobes: too many pieces");
+
+    for (double k = first; k <= last; ++k) borders.push_back(k * halfPeriod);
+  }
+
+  borders.push_back(uB);
+  return borders;
+}
+
+// Integral of func over [a, b] after the substitution. Lobes are integrated
+// independently by single-threaded Gauss-Kronrod tasks with prec shares
+// proportional to their lengths, and summed in order
+template <Integrand F>
+QuadratureResult IntegrateOscillatory(const F& func, const Substitution& subst,
+                                      double a, double b, double prec,
+                                      size_t nWorkers,
+                                      const AdaptiveQuadratureConfig& config = {}) {
+  assert(!subst.Empty() && subst.Jacobian && subst.U);
+  assert(nWorkers != 0);
+
+  double uA = subst.U(a);
+  double uB = subst.U(b);
+  if (uA > uB) std::swap(uA, uB);  // Decreasing X, |X'| keeps the sign
+
+  auto borders = SplitLobes(uA, uB, subst.HalfPeriod, config.MaxIntervals);
+  size_t nPieces = borders.size() - 1;
+
+  SubstitutedIntegrand<F> integrand(func, subst);
+  std::vector<Padded<QuadratureResult>> results(nPieces);
+
+  AdaptiveQuadratureConfig pieceConfig = config;
+  pieceConfig.InitialIntervals = 1;
+
+  auto integrate = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      double share = prec * (borders[i + 1] - borders[i]) / (uB - uA);
+      results[i].Value = IntegrateAdaptive(integrand, borders[i],
+                                           borders[i + 1], share, 1,
+                                           pieceConfig);
+    }
+  };
+
+  if (nWorkers == 1)
+    integrate(0, nPieces);
+  else
+    WorkStealingPool::Instance(nWorkers).ParallelFor(nPieces, integrate,
+                                                     nPieces);
+
+  QuadratureResult res;
+  for (const auto& padded : results) {
+    res.Value += padded.Value.Value;
+    res.Error += padded.Value.Error;
+    res.NEvals += padded.Value.NEvals;
+    res.NIntervals += padded.Value.NIntervals;
+  }
+
+  return res;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <string>
+
+// Single step rules on [x, x + h] with nodes T[k] in [0, 1]:
+//   int f ~= h * sum_k W[k] * f(x + h * T[k])
+//
+// Error of the composite rule over a segment of length L:
+//   |E| <= ErrorConst * L * h^Order * max|f^(Order)|
+template <typename R>
+concept QuadratureRule = requires {
+  { R::NNodes } -> std::convertible_to<size_t>;
+  { R::Order } -> std::convertible_to<unsigned>;
+  { R::ErrorConst } -> std::convertible_to<double>;
+  { R::T[0] } -> std::convertible_to<double>;
+  { R::W[0] } -> std::convertible_to<double>;
+};
+
+struct MidpointRule {
+  static constexpr size_t NNodes = 1;
+  static constexpr std::array<double, NNodes> T = {0.5};
+  static constexpr std::array<double, NNodes> W = {1};
+
+  static constexpr unsigned Order = 2;
+  static constexpr double ErrorConst = 1. / 24;
+};
+
+struct TrapezoidRule {
+  static constexpr size_t NNodes = 2;
+  static constexpr std::array<double, NNodes> T = {0, 1};
+  static constexpr std::array<double, NNodes> W = {0.5, 0.5};
+
+  static constexpr unsigned Order = 2;
+  static constexpr double ErrorConst = 1. / 12;
+};
+
+struct SimpsonRule {
+  static constexpr size_t NNodes = 3;
+  static constexpr std::array<double, NNodes> T = {0, 0.5, 1};
+  static constexpr std::array<double, NNodes> W = {1. / 6, 4. / 6, 1. / 6};
+
+  static constexpr unsigned Order = 4;
+  static constexpr double ErrorConst = 1. / 2880;
+};
+
+// Nodes and weights of Gauss-Legendre rule on [-1, 1], positive half
+template <size_t N> struct GaussLegendreTable;
+
+template <> struct GaussLegendreTable<1> {
+  static constexpr double X[] = {0};
+  static constexpr double W[] = {2};
+};
+
+template <> struct GaussLegendreTable<2> {
+  static constexpr double X[] = {0.5773502691896257645091488};
+  static constexpr double W[] = {1};
+};
+
+template <> struct GaussLegendreTable<3> {
+  static constexpr double X[] = {0, 0.7745966692414833770358531};
+  static constexpr double W[] = {8. / 9, 5. / 9};
+};
+
+template <> struct GaussLegendreTable<4> {
+  static constexpr double X[] = {0.3399810435848562648026658,
+                                 0.8611363115940525752239465};
+  static constexpr double W[] = {0.6521451548625461426269361,
+                                 0.3478548451374538573730639};
+};
+
+template <> struct GaussLegendreTable<5> {
+  static constexpr double X[] = {0, 0.5384693101056830910363144,
+                                 0.9061798459386639927976269};
+  static constexpr double W[] = {0.5688888888888888888888889,
+                                 0.4786286704993664680412915,
+                                 0.2369268850561890875142640};
+};
+
+template <size_t N> struct GaussLegendreRule {
+ private:
+  using Table = GaussLegendreTable<N>;
+
+  // Unfolds the symmetric table and maps it from [-1, 1] onto [0, 1]
+  template <bool Weights>
+  static constexpr std::array<double, N> Unfold() {
+    std::array<double, N> res = {};
+    constexpr size_t half = (N + 1) / 2;
+
+    for (size_t i = 0; i < half; ++i) {
+      size_t j = half - 1 - i;  // Table index, from the outermost node
+      double x = Table::X[j];
+      double w = Table::W[j];
+
+      res[i] = Weights ? w / 2 : (1 - x) / 2;
+      res[N - 1 - i] = Weights ? w / 2 : (1 + x) / 2;
+    }
+    return res;
+  }
+
+  static constexpr double Factorial(size_t n) {
+    return n == 0 ? 1 : n * Factorial(n - 1);
+  }
+
+ public:
+  static constexpr size_t NNodes = N;
+  static constexpr std::array<double, NNodes> T = Unfold<false>();
+  static constexpr std::array<double, NNodes> W = Unfold<true>();
+
+  static constexpr unsigned Order = 2 * N;
+  static constexpr double ErrorConst =
+      Factorial(N) * Factorial(N) * Factorial(N) * Factorial(N) /
+      ((2 * N + 1) * Factorial(2 * N) * Factorial(2 * N) * Factorial(2 * N));
+};
+
+// Step providing the rule precision on a segment, given the bound of
+// |f^(Order)| over it
+template <QuadratureRule Rule>
+double RuleStep(double derivBound, double size, double prec) {
+  return pow(prec / (Rule::ErrorConst * size * derivBound), 1. / Rule::Order);
+}
+
+// Rules with nodes on both step borders share them between adjacent steps
+template <QuadratureRule Rule>
+constexpr bool SharesBorders =
+    Rule::NNodes > 1 && Rule::T[0] == 0 && Rule::T[Rule::NNodes - 1] == 1 &&
+    Rule::W[0] == Rule::W[Rule::NNodes - 1];
+
+// Calls visitor.template operator()<Rule>() for the rule with given name:
+// midpoint, trapezoid, simpson, gauss1..gauss5. Returns false on unknown one
+template <typename Visitor>
+bool VisitRule(const std::string& name, Visitor&& visitor) {
+  if (name == "midpoint")
+    visitor.template operator()<MidpointRule>();
+  else if (name == "trapezoid")
+    visitor.template operator()<TrapezoidRule>();
+  else if (name == "simpson")
+    visitor.template operator()<SimpsonRule>();
+  else if (name == "gauss1")
+    visitor.template operator()<GaussLegendreRule<1>>();
+  else if (name == "gauss2")
+    visitor.template operator()<GaussLegendreRule<2>>();
+  else if (name == "gauss3")
+    visitor.template operator()<GaussLegendreRule<3>>();
+  else if (name == "gauss4")
+    visitor.template operator()<GaussLegendreRule<4>>();
+  else if (name == "gauss5")
+    visitor.template operator()<GaussLegendreRule<5>>();
+  else
+    return false;
+
+  return true;
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <Integrand.hpp>
+#include <ThreadPool.hpp>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+// Batch form of a multi-dimensional integrand, points are passed by
+// coordinates: out[i] = f(coords[0][i], ..., coords[dim - 1][i]), i < n
+template <typename F>
+concept MultiIntegrand = requires(const F& f, const double* const* coords,
+                                  double* out, size_t n) {
+  f(coords, out, n);
+};
+
+// Halton sequence: coordinate d of point i is the radical inverse of i in
+// the d-th prime base. Any point is available without generating the
+// preceding ones, so threads and ranks skip ahead to their index ranges
+class HaltonStream final {
+ private:
+  static constexpr unsigned Primes[] = {
+      2,   3,   5,   7,   11,  13,  17,  19,  23,  29,  31,  37,  41,
+      43,  47,  53,  59,  61,  67,  71,  73,  79,  83,  89,  97,  101,
+      103, 107, 109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167,
+      173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229, 233, 239};
+
+  struct Digits {
+    unsigned Base;
+    std::vector<unsigned> Digit;    // Least significant first
+    std::vector<double> InvPow;     // Base^-(j + 1)
+    double Value = 0;
+  };
+
+  std::vector<Digits> Dims;
+
+  // Odometer increment, only the carried digits are touched
+  static void Increment(Digits& dig) {
+    size_t j = 0;
+    for (; j < dig.Digit.size() && dig.Digit[j] == dig.Base - 1; ++j) {
+      dig.Digit[j] = 0;
+      dig.Value -= (dig.Base - 1) * dig.InvPow[j];
+    }
+
+    if (j == dig.Digit.size()) {
+      dig.Digit.push_back(0);
+      dig.InvPow.push_back(dig.InvPow.back() / dig.Base);
+    }
+
+    dig.Digit[j]++;
+    dig.Value += dig.InvPow[j];
+  }
+
+ public:
+  static constexpr size_t MaxDim = sizeof(Primes) / sizeof(Primes[0]);
+
+  HaltonStream(size_t dim, uint64_t index) : Dims(dim) {
+    if (dim == 0 || dim > MaxDim)
+      throw std::invalid_argument("HaltonStream: unsupported dimension");
+
+    for (size_t d = 0; d < dim; ++d) {
+      auto& dig = Dims[d];
+      dig.Base = Primes[d];
+      dig.InvPow = {1. / dig.Base};
+
+      for (uint64_t rest = index; rest; rest /= dig.Base) {
+        if (dig.InvPow.size() == dig.Digit.size())
+          dig.InvPow.push_back(dig.InvPow.back() / dig.Base);
+        dig.Digit.push_back(rest % dig.Base);
+        dig.Value += dig.Digit.back() * dig.InvPow[dig.Digit.size() - 1];
+      }
+    }
+  }
+
+  // Writes the current point to coords[d][i] and advances
+  void Next(double* const* coords, size_t i) {
+    for (size_t d = 0; d < Dims.size(); ++d) {
+      coords[d][i] = Dims[d].Value;
+      Increment(Dims[d]);
+    }
+  }
+};
+
+struct QmcConfig {
+  uint64_t NPoints = 1 << 20;  // Per shift
+  size_t NShifts = 16;         // Independent randomizations
+  uint64_t Seed = 42;          // Same on every rank
+  uint64_t BlockPoints = 1 << 14;  // Work unit, fixes the summation order
+};
+
+struct QmcResult {
+  double Value = 0;
+  double Error = 0;  // Standard error over the shifts
+  uint64_t NEvals = 0;
+};
+
+// Axis-aligned box [Lo[d], Hi[d]]
+struct QmcBox {
+  std::vector<double> Lo;
+  std::vector<double> Hi;
+
+  size_t Dim() const { return Lo.size(); }
+
+  double Volume() const {
+    double vol = 1;
+    for (size_t d = 0; d < Dim(); ++d) vol *= Hi[d] - Lo[d];
+    return vol;
+  }
+};
+
+// Cranley-Patterson rotations: shift r moves the whole point set by
+// Shifts[r * dim + d] modulo 1
+inline std::vector<double> QmcShifts(size_t dim, const QmcConfig& config) {
+  std::mt19937_64 gen(config.Seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  std::vector<double> shifts(config.NShifts * dim);
+  for (auto& shift : shifts) shift = uniform(gen);
+  return shifts;
+}
+
+// Sums of f over points [begin, end) of every shifted sequence. Blocks of
+// BlockPoints are spread over nWorkers and summed in index order, so the
+// sums don't depend on nWorkers
+template <MultiIntegrand F>
+std::vector<double> QmcPartialSums(const F& func, const QmcBox& box,
+                                   const QmcConfig& config, uint64_t begin,
+                                   uint64_t end, size_t nWorkers) {
+  assert(box.Dim() && box.Hi.size() == box.Dim());
+  assert(config.NShifts && config.BlockPoints);
+
+  const size_t dim = box.Dim();
+  const size_t nShifts = config.NShifts;
+  const auto shifts = QmcShifts(dim, config);
+
+  uint64_t nBlocks = (end - begin + config.BlockPoints - 1) / config.BlockPoints;
+
+  // blockSums[b * nShifts + r]
+  std::vector<double> blockSums(nBlocks * nShifts, 0);
+
+  auto integrate = [&](size_t blockBegin, size_t blockEnd) {
+    alignas(64) double base[HaltonStream::MaxDim][IntegrateBatchSize];
+    alignas(64) double point[HaltonStream::MaxDim][IntegrateBatchSize];
+    alignas(64) double fs[IntegrateBatchSize];
+
+    double* baseRows[HaltonStream::MaxDim];
+    const double* pointRows[HaltonStream::MaxDim];
+    for (size_t d = 0; d < dim; ++d) {
+      baseRows[d] = base[d];
+      pointRows[d] = point[d];
+    }
+
+    struct ShiftAcc {
+      double Sum[IntegrateNAccumulators] = {};
+    };
+    std::vector<ShiftAcc> acc(nShifts);
+
+    for (size_t b = blockBegin; b < blockEnd; ++b) {
+      uint64_t from = begin + b * config.BlockPoints;
+      uint64_t to = std::min(end, from + config.BlockPoints);
+
+      HaltonStream stream(dim, from);
+      acc.assign(nShifts, {});
+
+      for (uint64_t done = from; done < to; done += IntegrateBatchSize) {
+        size_t n = std::min<uint64_t>(IntegrateBatchSize, to - done);
+        for (size_t i = 0; i < n; ++i) stream.Next(baseRows, i);
+
+        for (size_t r = 0; r < nShifts; ++r) {
+          for (size_t d = 0; d < dim; ++d) {
+            double shift = shifts[r * dim + d];
+            double lo = box.Lo[d];
+            double len = box.Hi[d] - box.Lo[d];
+
+#pragma omp simd
+            for (size_t i = 0; i < n; ++i) {
+              double u = base[d][i] + shift;
+              u -= (u >= 1);
+              point[d][i] = lo + len * u;
+            }
+          }
+
+          func(pointRows, fs, n);
+          Accumulate(acc[r].Sum, fs, n);
+        }
+      }
+
+      for (size_t r = 0; r < nShifts; ++r)
+        blockSums[b * nShifts + r] = Reduce(acc[r].Sum);
+    }
+  };
+
+  if (nWorkers == 1)
+    integrate(0, nBlocks);
+  else
+    WorkStealingPool::Instance(nWorkers).ParallelFor(nBlocks, integrate);
+
+  std::vector<double> sums(nShifts, 0);
+  for (uint64_t b = 0; b < nBlocks; ++b)
+    for (size_t r = 0; r < nShifts; ++r) sums[r] += blockSums[b * nShifts + r];
+
+  return sums;
+}
+
+// Mean over the shifts and its standard error
+inline QmcResult QmcFinish(const std::vector<double>& sums,
+                           const QmcBox& box, const QmcConfig& config) {
+  const size_t nShifts = sums.size();
+  double vol = box.Volume();
+
+  double mean = 0;
+  for (double sum : sums) mean += vol * sum / config.NPoints;
+  mean /= nShifts;
+
+  double var = 0;
+  for (double sum : sums) {
+    double dev = vol * sum / config.NPoints - mean;
+    var += dev * dev;
+  }
+  var /= nShifts > 1 ? nShifts - 1 : 1;
+
+  return {mean, sqrt(var / nShifts), config.NPoints * nShifts};
+}
+
+// Randomized QMC over the box with NPoints * NShifts evaluations
+template <MultiIntegrand F>
+QmcResult IntegrateQmc(const F& func, const QmcBox& box,
+                       const QmcConfig& config, size_t nWorkers) {
+  assert(nWorkers != 0);
+  auto sums = QmcPartialSums(func, box, config, 0, config.NPoints, nWorkers);
+  return QmcFinish(sums, box, config);
+}
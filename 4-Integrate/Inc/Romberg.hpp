@@ -0,0 +1,157 @@
+#pragma once
+
+#include <AdaptiveQuadrature.hpp>
+#include <Integrand.hpp>
+#include <ThreadPool.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+struct RombergConfig {
+  size_t NPartitions = 64;  // Independent pieces of [A, B]
+  size_t InitialSteps = 16;
+  size_t MaxLevel = 24;     // Up to InitialSteps * 2^MaxLevel steps
+  size_t MaxColumns = 8;    // Richardson extrapolation depth
+  size_t MinLevel = 2;      // Guards against accidental agreement
+};
+
+// Progressive refinement on a fixed set of partitions: every level halves
+// the steps of a partition and evaluates only the new midpoints, the
+// trapezoid sums are combined by Romberg extrapolation. State is kept
+// between Refine() calls, so asking for more digits later reuses all of
+// the evaluations already made
+template <Integrand F>
+class RombergIntegrator final {
+ private:
+  struct Partition {
+    double A;
+    double B;
+    size_t NSteps = 0;
+    size_t Level = 0;
+    double Trapezoid = 0;
+    std::vector<double> Row;  // Last row of the Romberg table
+    double Error = INFINITY;  // Difference of the last two diagonal values
+    size_t NEvals = 0;
+
+    double Value() const { return Row.empty() ? 0 : Row.back(); }
+  };
+
+  const F& Func;
+  const RombergConfig Config;
+  std::vector<Padded<Partition>> Partitions;
+
+ private:
+  // Sum of f(start + i * h), i < n
+  double SumPoints(double start, double h, size_t n) const {
+    alignas(64) double xs[IntegrateBatchSize];
+    alignas(64) double fs[IntegrateBatchSize];
+    double acc[IntegrateNAccumulators] = {};
+
+    for (size_t done = 0; done < n; done += IntegrateBatchSize) {
+      size_t count = std::min(IntegrateBatchSize, n - done);
+
+#pragma omp simd
+      for (size_t i = 0; i < count; ++i) xs[i] = start + (done + i) * h;
+
+      EvalBatch(Func, xs, fs, count);
+      Accumulate(acc, fs, count);
+    }
+
+    return Reduce(acc);
+  }
+
+  void Extrapolate(Partition& part) const {
+    std::vector<double> row(std::min(part.Level, Config.MaxColumns) + 1);
+    row[0] = part.Trapezoid;
+
+    double factor = 1;
+    for (size_t j = 1; j < row.size(); ++j) {
+      factor *= 4;
+      row[j] = row[j - 1] + (row[j - 1] - part.Row[j - 1]) / (factor - 1);
+    }
+
+    if (part.Level >= Config.MinLevel)
+      part.Error = fabs(row.back() - part.Value());
+
+    part.Row = std::move(row);
+  }
+
+  void Start(Partition& part) const {
+    size_t n = Config.InitialSteps;
+    double h = (part.B - part.A) / n;
+
+    double ends[2] = {part.A, part.B};
+    double fEnds[2];
+    EvalBatch(Func, ends, fEnds, 2);
+
+    part.Trapezoid =
+        h * ((fEnds[0] + fEnds[1]) / 2 + SumPoints(part.A + h, h, n - 1));
+    part.NSteps = n;
+    part.NEvals = n + 1;
+    part.Row = {part.Trapezoid};
+  }
+
+  // One more level: only the midpoints of the current steps are evaluated
+  void Halve(Partition& part) const {
+    double h = (part.B - part.A) / part.NSteps;
+    double mids = SumPoints(part.A + h / 2, h, part.NSteps);
+
+    part.Trapezoid = part.Trapezoid / 2 + (h / 2) * mids;
+    part.NEvals += part.NSteps;
+    part.NSteps *= 2;
+    part.Level++;
+
+    Extrapolate(part);
+  }
+
+  void Refine(Partition& part, double target) const {
+    if (part.NSteps == 0) Start(part);
+    while (part.Error > target && part.Level < Config.MaxLevel) Halve(part);
+  }
+
+ public:
+  RombergIntegrator(const F& func, double a, double b,
+                    const RombergConfig& config = {})
+      : Func{func}, Config{config}, Partitions(config.NPartitions) {
+    assert(config.NPartitions && config.InitialSteps);
+
+    double size = (b - a) / config.NPartitions;
+    for (size_t i = 0; i < config.NPartitions; ++i) {
+      auto& part = Partitions[i].Value;
+      part.A = a + size * i;
+      part.B = (i + 1 == config.NPartitions) ? b : part.A + size;
+    }
+  }
+
+  // Refines until every partition meets its share of prec (proportional to
+  // its length) or reaches MaxLevel
+  QuadratureResult Refine(double prec, size_t nWorkers) {
+    assert(prec > 0);
+    double length = Partitions.back().Value.B - Partitions.front().Value.A;
+
+    auto refine = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        auto& part = Partitions[i].Value;
+        Refine(part, prec * (part.B - part.A) / length);
+      }
+    };
+
+    if (nWorkers == 1)
+      refine(0, Partitions.size());
+    else  // One partition per task, hard ones are balanced by stealing
+      WorkStealingPool::Instance(nWorkers).ParallelFor(
+          Partitions.size(), refine, Partitions.size());
+
+    QuadratureResult res;
+    for (const auto& padded : Partitions) {
+      const auto& part = padded.Value;
+      res.Value += part.Value();
+      res.Error += part.Error;
+      res.NEvals += part.NEvals;
+    }
+    res.NIntervals = Partitions.size();
+
+    return res;
+  }
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Integration.hpp>
+#include <Taylor.hpp>
+#include <VecMath.hpp>
+
+static constexpr double RealVal = 2.50344;
+
+// The task: integral of sin(1/x) over [0.01, 8]. Derivatives and their
+// bounds are derived from this single definition (see Taylor.hpp)
+struct TaskFunc {
+  template <typename T> T operator()(const T& x) const {
+    using std::sin;
+    return sin(1 / x);
+  }
+};
+
+// Its derivative, -cos(1/x) / x^2
+struct TaskFuncD {
+  template <typename T> T operator()(const T& x) const {
+    using std::cos;
+    return -cos(1 / x) / (x * x);
+  }
+};
+
+double Func(double x) { return TaskFunc{}(x); }
+
+double FuncD(double x) { return Derivative(TaskFunc{}, x); }
+
+// Step of the derivative rule: h^2 * size * max|f''| <= prec
+double Prec2h(AdaptiveGrid::FuncT, double start, double size, double prec) {
+  double den = size * DerivBound<2>(TaskFunc{}, start, size);
+  double h2 = prec / den;
+
+  return sqrt(h2);
+}
+
+template <QuadratureRule Rule, typename TF = TaskFunc>
+double RuleStepEval(AdaptiveGrid::FuncT, double start, double size,
+                    double prec) {
+  return RuleStep<Rule>(DerivBound<Rule::Order>(TF{}, start, size), size,
+                        prec);
+}
+
+// Batch forms of Func and FuncD, vectorized by hand for the hot loops
+struct FuncBatch {
+  static constexpr double Flops = 1 + BatchSinCosFlops;
+
+  void operator()(const double* x, double* out, size_t n) const {
+#pragma omp simd
+    for (size_t i = 0; i < n; ++i) out[i] = 1 / x[i];
+    BatchSin(out, out, n);
+  }
+};
+
+struct FuncDBatch {
+  static constexpr double Flops = 4 + BatchSinCosFlops;
+
+  void operator()(const double* x, double* out, size_t n) const {
+#pragma omp simd
+    for (size_t i = 0; i < n; ++i) out[i] = 1 / x[i];
+    BatchCos(out, out, n);
+#pragma omp simd
+    for (size_t i = 0; i < n; ++i) out[i] = -out[i] / (x[i] * x[i]);
+  }
+};
+
+// Function pointer form of FuncBatch for AdaptiveGrid::BuildConfig
+void FuncBatchFn(const double* x, double* out, size_t n) {
+  FuncBatch{}(x, out, n);
+}
+
+// u = 1/x turns sin(1/x) dx into sin(u) / u^2 du, lobes are [k*pi, (k+1)*pi]
+double TaskSubstX(double u) { return 1 / u; }
+
+double TaskSubstJacobian(double u) { return -1 / (u * u); }
+
+Substitution TaskSubstitution() {
+  return {TaskSubstX, TaskSubstJacobian, TaskSubstX, M_PI};
+}
+
+IntegrateArgs TaskArgs(double nDigits) {
+  IntegrateArgs args;
+
+  args.Func = Func;
+  args.FuncD = FuncD;
+  args.StepEval = Prec2h;
+  args.Subst = TaskSubstitution();
+
+  args.A = 0.01;
+  args.B = 8;
+
+  args.GridResolution = 10;
+  args.Prec = 1 / pow(10, nDigits);
+
+  return args;
+}
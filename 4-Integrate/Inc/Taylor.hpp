@@ -0,0 +1,212 @@
+#pragma once
+
+#include <Interval.hpp>
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+// Truncated Taylor series of an expression in t around x:
+// C[k] = f^(k)(x) / k!, k <= N. Forward mode: templated integrands
+//   template <typename T> T operator()(const T& x) const
+// evaluated on Taylor<double, N> give the derivatives at a point, and on
+// Taylor<Interval, N> enclosures of the derivatives over a whole interval
+template <typename T, size_t N>
+struct Taylor {
+  std::array<T, N + 1> C{};
+
+  Taylor() = default;
+  Taylor(double val) { C[0] = T(val); }
+
+  // The independent variable at x
+  static Taylor Variable(const T& x) {
+    Taylor res;
+    res.C[0] = x;
+    if constexpr (N > 0) res.C[1] = T(1);
+    return res;
+  }
+
+  const T& operator[](size_t k) const { return C[k]; }
+};
+
+template <typename T, size_t N>
+Taylor<T, N> operator+(const Taylor<T, N>& lhs, const Taylor<T, N>& rhs) {
+  Taylor<T, N> res;
+  for (size_t k = 0; k <= N; ++k) res.C[k] = lhs.C[k] + rhs.C[k];
+  return res;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator-(const Taylor<T, N>& lhs, const Taylor<T, N>& rhs) {
+  Taylor<T, N> res;
+  for (size_t k = 0; k <= N; ++k) res.C[k] = lhs.C[k] - rhs.C[k];
+  return res;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator-(const Taylor<T, N>& val) {
+  Taylor<T, N> res;
+  for (size_t k = 0; k <= N; ++k) res.C[k] = -val.C[k];
+  return res;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator*(const Taylor<T, N>& lhs, const Taylor<T, N>& rhs) {
+  Taylor<T, N> res;
+  for (size_t k = 0; k <= N; ++k) {
+    T sum = lhs.C[0] * rhs.C[k];
+    for (size_t j = 1; j <= k; ++j) sum += lhs.C[j] * rhs.C[k - j];
+    res.C[k] = sum;
+  }
+  return res;
+}
+
+// q = a / b: b_0 q_k = a_k - sum_{j=1..k} b_j q_{k-j}
+template <typename T, size_t N>
+Taylor<T, N> operator/(const Taylor<T, N>& lhs, const Taylor<T, N>& rhs) {
+  Taylor<T, N> res;
+  for (size_t k = 0; k <= N; ++k) {
+    T sum = lhs.C[k];
+    for (size_t j = 1; j <= k; ++j) sum -= rhs.C[j] * res.C[k - j];
+    res.C[k] = sum / rhs.C[0];
+  }
+  return res;
+}
+
+// Mixed forms, so that integrands may be written as 1 / x, 2 * x, ...
+template <typename T, size_t N>
+Taylor<T, N> operator+(const Taylor<T, N>& lhs, double rhs) {
+  return lhs + Taylor<T, N>(rhs);
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator+(double lhs, const Taylor<T, N>& rhs) {
+  return Taylor<T, N>(lhs) + rhs;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator-(const Taylor<T, N>& lhs, double rhs) {
+  return lhs - Taylor<T, N>(rhs);
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator-(double lhs, const Taylor<T, N>& rhs) {
+  return Taylor<T, N>(lhs) - rhs;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator*(const Taylor<T, N>& lhs, double rhs) {
+  Taylor<T, N> res;
+  for (size_t k = 0; k <= N; ++k) res.C[k] = lhs.C[k] * T(rhs);
+  return res;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator*(double lhs, const Taylor<T, N>& rhs) {
+  return rhs * lhs;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator/(const Taylor<T, N>& lhs, double rhs) {
+  return lhs / Taylor<T, N>(rhs);
+}
+
+template <typename T, size_t N>
+Taylor<T, N> operator/(double lhs, const Taylor<T, N>& rhs) {
+  return Taylor<T, N>(lhs) / rhs;
+}
+
+// s' = a' c, c' = -a' s: k s_k = sum_{j=1..k} j a_j c_{k-j}
+template <typename T, size_t N>
+void SinCos(const Taylor<T, N>& val, Taylor<T, N>& s, Taylor<T, N>& c) {
+  using std::cos;
+  using std::sin;
+
+  s.C[0] = sin(val.C[0]);
+  c.C[0] = cos(val.C[0]);
+
+  for (size_t k = 1; k <= N; ++k) {
+    T sumS = T(0);
+    T sumC = T(0);
+    for (size_t j = 1; j <= k; ++j) {
+      T ja = val.C[j] * T(double(j));
+      sumS += ja * c.C[k - j];
+      sumC += ja * s.C[k - j];
+    }
+    s.C[k] = sumS / T(double(k));
+    c.C[k] = -sumC / T(double(k));
+  }
+}
+
+template <typename T, size_t N>
+Taylor<T, N> sin(const Taylor<T, N>& val) {
+  Taylor<T, N> s, c;
+  SinCos(val, s, c);
+  return s;
+}
+
+template <typename T, size_t N>
+Taylor<T, N> cos(const Taylor<T, N>& val) {
+  Taylor<T, N> s, c;
+  SinCos(val, s, c);
+  return c;
+}
+
+// e' = a' e
+template <typename T, size_t N>
+Taylor<T, N> exp(const Taylor<T, N>& val) {
+  using std::exp;
+
+  Taylor<T, N> res;
+  res.C[0] = exp(val.C[0]);
+
+  for (size_t k = 1; k <= N; ++k) {
+    T sum = T(0);
+    for (size_t j = 1; j <= k; ++j)
+      sum += val.C[j] * T(double(j)) * res.C[k - j];
+    res.C[k] = sum / T(double(k));
+  }
+  return res;
+}
+
+// a l' = a': k a_0 l_k = k a_k - sum_{j=1..k-1} j l_j a_{k-j}
+template <typename T, size_t N>
+Taylor<T, N> log(const Taylor<T, N>& val) {
+  using std::log;
+
+  Taylor<T, N> res;
+  res.C[0] = log(val.C[0]);
+
+  for (size_t k = 1; k <= N; ++k) {
+    T sum = val.C[k] * T(double(k));
+    for (size_t j = 1; j < k; ++j)
+      sum -= res.C[j] * T(double(j)) * val.C[k - j];
+    res.C[k] = sum / (val.C[0] * T(double(k)));
+  }
+  return res;
+}
+
+// f'(x) of a templated integrand
+template <typename TF>
+double Derivative(const TF& func, double x) {
+  return func(Taylor<double, 1>::Variable(x))[1];
+}
+
+// Rigorous bound of |f^(k)| over [start, start + size]: the interval is
+// split into nSub pieces, which keeps the overestimation of interval
+// arithmetic low, and the largest enclosure is taken
+template <unsigned K, typename TF>
+double DerivBound(const TF& func, double start, double size,
+                  size_t nSub = 16) {
+  double factorial = 1;
+  for (unsigned i = 2; i <= K; ++i) factorial *= i;
+
+  double bound = 0;
+  for (size_t i = 0; i < nSub; ++i) {
+    Interval x = Interval::Outward(start + size * i / nSub,
+                                   start + size * (i + 1) / nSub);
+    auto coef = func(Taylor<Interval, K>::Variable(x))[K];
+    bound = std::max(bound, coef.Mag());
+  }
+
+  return Interval::Up(bound * factorial);
+}
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <Affinity.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of workers, each owning a deque of tasks.
+// Owner pops from the bottom of its deque (LIFO, cache-friendly),
+// idle workers steal from the top of the others' deques (FIFO, i.e. the
+// largest remaining amount of work is handed away first).
+// Workers are pinned according to the PlacementPolicy and allocate their
+// own state after pinning, so it is first-touched on the worker's node.
+// Queued tasks are allocated by the submitting thread
+class WorkStealingPool final {
+ public:
+  using TaskT = std::function<void()>;
+
+  struct WorkerStats {
+    double BusyMs = 0;
+    size_t NTasks = 0;
+    size_t NStolen = 0;
+  };
+
+ private:
+  struct alignas(CacheLineSize) Worker {
+    std::mutex Mutex;
+    std::deque<TaskT> Tasks;
+    std::deque<TaskT> Bound;  // Run by this worker only, never stolen
+    WorkerStats Stats;
+  };
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::vector<std::thread> Threads;
+  PlacementPolicy Placement;
+
+  std::mutex SleepMutex;
+  std::condition_variable WakeUp;
+  std::condition_variable Done;
+
+  size_t NStarted = 0;   // Workers with allocated state, guarded by SleepMutex
+  size_t Available = 0;  // Queued and not yet taken, guarded by SleepMutex
+  std::atomic<size_t> Pending = 0;  // Submitted and not yet finished
+  bool Stop = false;
+
+  static inline thread_local size_t CurrentIndex = -1;
+
+ private:
+  bool PopOwn(size_t index, TaskT& task) {
+    auto& worker = *Workers[index];
+    std::lock_guard<std::mutex> _(worker.Mutex);
+
+    if (!worker.Bound.empty()) {
+      task = std::move(worker.Bound.front());
+      worker.Bound.pop_front();
+      return true;
+    }
+
+    if (worker.Tasks.empty()) return false;
+
+    task = std::move(worker.Tasks.back());
+    worker.Tasks.pop_back();
+    return true;
+  }
+
+  bool Steal(size_t index, TaskT& task) {
+    for (size_t i = 1; i < Workers.size(); ++i) {
+      auto& victim = *Workers[(index + i) % Workers.size()];
+      std::lock_guard<std::mutex> _(victim.Mutex);
+      if (victim.Tasks.empty()) continue;
+
+      task = std::move(victim.Tasks.front());
+      victim.Tasks.pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  // Blocks until some task appears or the pool is stopped
+  bool WaitForWork() {
+    std::unique_lock<std::mutex> lock(SleepMutex);
+    WakeUp.wait(lock, [this] { return Stop || Available != 0; });
+    return !Stop;
+  }
+
+  void TakeOne() {
+    std::lock_guard<std::mutex> _(SleepMutex);
+    assert(Available != 0);
+    Available--;
+  }
+
+  void Push(size_t worker, TaskT task, bool bound) {
+    auto& dst = *Workers[worker % Workers.size()];
+    Pending++;
+
+    {
+      // Task is pushed under SleepMutex so that Available never lags behind
+      std::lock_guard<std::mutex> sleepLock(SleepMutex);
+      std::lock_guard<std::mutex> dstLock(dst.Mutex);
+      (bound ? dst.Bound : dst.Tasks).push_back(std::move(task));
+      Available++;
+    }
+    // Bound task may wait for a specific sleeping worker
+    if (bound)
+      WakeUp.notify_all();
+    else
+      WakeUp.notify_one();
+  }
+
+  void Routine(size_t index) {
+    CurrentIndex = index;
+
+    try {
+      Placement.Pin(index);
+    } catch (std::exception& e) {
+      std::cerr << "Worker #" << index << " is not pinned: " << e.what()
+                << std::endl;
+    }
+
+    {
+      auto worker = std::make_unique<Worker>();
+      std::unique_lock<std::mutex> lock(SleepMutex);
+      Workers[index] = std::move(worker);
+      NStarted++;
+      Done.notify_all();
+
+      // Others' deques are accessed on stealing
+      Done.wait(lock, [this] { return NStarted == Workers.size(); });
+    }
+
+    auto& stats = Workers[index]->Stats;
+
+    while (true) {
+      TaskT task;
+      bool stolen = false;
+
+      if (!PopOwn(index, task)) {
+        stolen = Steal(index, task);
+        if (!stolen) {
+          if (!WaitForWork()) return;
+          // Available work may be bound to another worker
+          std::this_thread::yield();
+          continue;
+        }
+      }
+
+      TakeOne();
+
+      auto start = std::chrono::steady_clock::now();
+      task();
+      auto end = std::chrono::steady_clock::now();
+
+      stats.BusyMs +=
+          std::chrono::duration<double, std::milli>(end - start).count();
+      stats.NTasks++;
+      stats.NStolen += stolen;
+
+      if (--Pending == 0) {
+        std::lock_guard<std::mutex> _(SleepMutex);
+        Done.notify_all();
+      }
+    }
+  }
+
+ public:
+  explicit WorkStealingPool(size_t nWorkers,
+                            const PlacementPolicy& placement = {})
+      : Workers(nWorkers), Placement{placement} {
+    assert(nWorkers != 0);
+
+    for (size_t i = 0; i < nWorkers; ++i)
+      Threads.emplace_back(&WorkStealingPool::Routine, this, i);
+
+    std::unique_lock<std::mutex> lock(SleepMutex);
+    Done.wait(lock, [this] { return NStarted == Workers.size(); });
+  }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> _(SleepMutex);
+      Stop = true;
+    }
+    WakeUp.notify_all();
+    for (auto& thread : Threads) thread.join();
+  }
+
+  size_t Size() const { return Workers.size(); }
+
+  // Index of the calling pool worker, -1 for foreign threads
+  static size_t Current() { return CurrentIndex; }
+
+  // Pushes task to the bottom of the worker's deque
+  void Submit(size_t worker, TaskT task) {
+    Push(worker, std::move(task), false);
+  }
+
+  // Calls fn(worker) on every worker itself and waits, e.g. to first-touch
+  // per-worker data
+  template <typename F>
+  void OnEachWorker(const F& fn) {
+    for (size_t w = 0; w < Size(); ++w) Push(w, [&fn, w] { fn(w); }, true);
+    Wait();
+  }
+
+  // Blocks until every submitted task is finished
+  void Wait() {
+    std::unique_lock<std::mutex> lock(SleepMutex);
+    Done.wait(lock, [this] { return Pending == 0; });
+  }
+
+  // Calls fn(begin, end) on disjoint ranges covering [0, n) and waits
+  template <typename F>
+  void ParallelFor(size_t n, const F& fn, size_t rangesPerWorker = 4) {
+    size_t nRanges = std::min(n, rangesPerWorker * Size());
+
+    for (size_t r = 0; r < nRanges; ++r) {
+      size_t begin = n * r / nRanges;
+      size_t end = n * (r + 1) / nRanges;
+      Submit(r, [&fn, begin, end] { fn(begin, end); });
+    }
+    Wait();
+  }
+
+  // Valid between Wait() and the next Submit()
+  const WorkerStats& Stats(size_t worker) const {
+    return Workers[worker]->Stats;
+  }
+
+  void ResetStats() {
+    for (auto& worker : Workers) worker->Stats = {};
+  }
+
+  const PlacementPolicy& GetPlacement() const { return Placement; }
+
+  // Placement of the pools created by Instance()
+  static PlacementPolicy& DefaultPlacement() {
+    static PlacementPolicy placement;
+    return placement;
+  }
+
+  // Lazily created pools shared by all the integration calls, one per
+  // (size, placement). A pool lives until the exit, so the returned
+  // reference stays valid when a call asks for another configuration
+  static WorkStealingPool& Instance(size_t nWorkers) {
+    static std::mutex mutex;
+    static std::vector<std::unique_ptr<WorkStealingPool>> pools;
+
+    std::lock_guard<std::mutex> _(mutex);
+    const auto& placement = DefaultPlacement();
+
+    for (auto& pool : pools)
+      if (pool->Size() == nWorkers && pool->GetPlacement() == placement)
+        return *pool;
+
+    pools.push_back(std::make_unique<WorkStealingPool>(nWorkers, placement));
+    return *pools.back();
+  }
+};
+
+// Per-worker blocks of padded slots. Every block is allocated and zeroed
+// by its worker, so it is first-touched on the worker's node
+template <typename T>
+class PerWorkerSlots final {
+ private:
+  std::vector<std::unique_ptr<Padded<T>[]>> Blocks;
+
+ public:
+  PerWorkerSlots(WorkStealingPool& pool, const std::vector<size_t>& sizes)
+      : Blocks(pool.Size()) {
+    assert(sizes.size() == pool.Size());
+    pool.OnEachWorker([&](size_t worker) {
+      Blocks[worker] = std::make_unique<Padded<T>[]>(sizes[worker]);
+    });
+  }
+
+  T& At(size_t worker, size_t slot) { return Blocks[worker][slot].Value; }
+};
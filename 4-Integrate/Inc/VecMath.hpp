@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+// Batch versions of libm functions: out[i] = f(x[i]), i < n.
+// In-place evaluation (out == x) is allowed.
+// With HAVE_LIBMVEC defined on x86-64 the 2-lane SSE variants of glibc
+// libmvec are used: they run on any x86-64, libmvec only picks SSE2 or
+// SSE4.1 code for them, while AVX2/AVX-512 versions are separate symbols.
+// Otherwise scalar libm is called in a simd-annotated loop.
+
+// Range reduction plus a degree 13 polynomial, either implementation
+static constexpr double BatchSinCosFlops = 20;
+
+#if defined(HAVE_LIBMVEC) && defined(__x86_64__)
+#include <emmintrin.h>
+
+extern "C" __m128d _ZGVbN2v_sin(__m128d);
+extern "C" __m128d _ZGVbN2v_cos(__m128d);
+
+template <__m128d (*VecF)(__m128d), double (*ScalarF)(double)>
+inline void BatchApply(const double* x, double* out, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(out + i, VecF(_mm_loadu_pd(x + i)));
+  for (; i < n; ++i) out[i] = ScalarF(x[i]);
+}
+
+inline void BatchSin(const double* x, double* out, size_t n) {
+  BatchApply<_ZGVbN2v_sin, ::sin>(x, out, n);
+}
+
+inline void BatchCos(const double* x, double* out, size_t n) {
+  BatchApply<_ZGVbN2v_cos, ::cos>(x, out, n);
+}
+
+#else
+
+inline void BatchSin(const double* x, double* out, size_t n) {
+#pragma omp simd
+  for (size_t i = 0; i < n; ++i) out[i] = sin(x[i]);
+}
+
+inline void BatchCos(const double* x, double* out, size_t n) {
+#pragma omp simd
+  for (size_t i = 0; i < n; ++i) out[i] = cos(x[i]);
+}
+
+#endif
@@ -1,46 +1,131 @@
+#include <iomanip>
+
+#include "BatchIntegration.hpp"
+#include "Benchmark.hpp"
 #include "Integration.hpp"
+#include "Task.hpp"
+
+template <QuadratureRule Rule>
+double IntegrateWithRule(IntegrateArgs args, size_t nWorkers) {
+  args.StepEval = RuleStepEval<Rule>;
+  return Integrate<Rule>(args, FuncBatch{}, nWorkers, true);
+}
+
+// Sweep in one IntegrateBatch call: the task integrand and its derivative
+// share the grid of the whole interval, the halves get their own grids.
+// Returns the integral over the whole interval
+double IntegrateSweep(const IntegrateArgs& args, size_t nWorkers) {
+  using Rule = SimpsonRule;
+
+  IntegrateArgs func = args;
+  func.StepEval = RuleStepEval<Rule>;
+
+  IntegrateArgs funcd = func;
+  funcd.Func = FuncD;
+  funcd.StepEval = RuleStepEval<Rule, TaskFuncD>;
 
-static constexpr double RealVal = 2.50344;
+  double mid = (args.A + args.B) / 2;
+  IntegrateArgs left = func, right = func;
+  left.B = right.A = mid;
 
-double Prec2h(AdaptiveGrid::FuncT, double start, double size, double prec) {
-  double den = size * (2 / pow(start, 3) + 1 / pow(start, 4));
-  double h2 = prec / den;
+  auto res = IntegrateBatch<Rule>({func, funcd, left, right}, nWorkers);
 
-  return sqrt(h2);
+  std::cout << std::setprecision(12) << "Batch: f " << res[0].Value
+            << " +- " << res[0].Error << ", f' " << res[1].Value << " (exact "
+            << Func(args.B) - Func(args.A) << "), halves " << res[2].Value
+            << " + " << res[3].Value << " = " << res[2].Value + res[3].Value
+            << std::endl;
+
+  return res[0].Value;
 }
 
-double Func(double x) { return sin(1 / x); }
+double Run(const std::string& method, IntegrateArgs& args, size_t nWorkers) {
+  if (method == "batch") return IntegrateSweep(args, nWorkers);
 
-double FuncD(double x) { return -cos(1 / x) / (x * x); }
+  if (method == "grid")
+    return Integrate(args, FuncBatch{}, FuncDBatch{}, nWorkers, true);
 
-int main(int argc, char** argv) {
-  if (argc != 2) {
-    std::cout << "Usage: ./4-Integrate <NWORKERS>";
-    return 1;
+  if (method == "adaptive") {
+    args.Engine = IntegrateEngine::Adaptive;
+    return Integrate(args, FuncBatch{}, FuncDBatch{}, nWorkers, true);
   }
 
-  size_t nWorkers = std::stoul(argv[1]);
+  if (method == "romberg") {
+    args.Engine = IntegrateEngine::Romberg;
+    return Integrate(args, FuncBatch{}, FuncDBatch{}, nWorkers, true);
+  }
 
-  IntegrateArgs args;
+  if (method == "oscillatory") {
+    args.Engine = IntegrateEngine::Oscillatory;
+    return Integrate(args, FuncBatch{}, FuncDBatch{}, nWorkers, true);
+  }
+
+  double val = 0;
+  auto withRule = [&]<QuadratureRule Rule>() {
+    val = IntegrateWithRule<Rule>(args, nWorkers);
+  };
+
+  if (VisitRule(method, withRule)) return val;
 
-  args.Func = Func;
-  args.FuncD = FuncD;
-  args.StepEval = Prec2h;
+  throw std::runtime_error("Unknown method: " + method);
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 4) {
+    std::cout << "Usage: ./4-Integrate <NWORKERS> [METHOD] [PLACEMENT]\n"
+                 "  METHOD: grid (default), midpoint, trapezoid, simpson,\n"
+                 "          gauss1..gauss5, adaptive, romberg, oscillatory, batch\n"
+                 "  PLACEMENT: none (default), compact, scatter, CPU list "
+                 "(0,2,4-7)"
+              << std::endl;
+    return 1;
+  }
 
-  args.A = 0.01;
-  args.B = 8;
+  size_t nWorkers = std::stoul(argv[1]);
+  std::string method = argc > 2 ? argv[2] : "grid";
 
-  args.GridResolution = 10;
+  if (argc > 3)
+    WorkStealingPool::DefaultPlacement() = PlacementPolicy::Parse(argv[3]);
 
   double nDigits = 10;
+  IntegrateArgs args = TaskArgs(nDigits);
+
+  // Grid depends on the method through StepEval
+  args.Id = "sin(1/x):" + method;
+  if (const char* cacheDir = getenv("GRID_CACHE_DIR"))
+    args.GridCacheDir = cacheDir;
+
+  // Grid is split between workers by the measured cost of FuncBatch
+  // instead of the number of steps
+  if (const char* samples = getenv("GRID_COST_SAMPLES")) {
+    args.GridBuild.CostSamples = std::stoul(samples);
+    args.GridBuild.CostFunc = FuncBatchFn;
+  }
+
+  Benchmark bench("4-Integrate", BenchmarkConfig::FromEnv());
+  bench.Param("workers", nWorkers);
+  bench.Param("method", method);
+
+  // Per-chunk events go to $TRACE_LOG if it is set, region stats to
+  // $INSTRUMENT
+  double val;
+  {
+    ScopedTrace trace;
+    ScopedInstrumentation instrumentation;
+    bench.Run([&] {
+      auto _ = bench.Time("compute");
+      val = Run(method, args, nWorkers);
+    });
+  }
 
-  args.Prec = 1 / pow(10, nDigits);
+  bench.Report();
+  bench.WriteJson();
 
-  double val = Integrate(args, nWorkers, true);
   double formatNorm = (pow(10, nDigits + 1));
   double err = fabs(RealVal - val);
 
-  std::cout << "Integral value: " << round(val * formatNorm) / formatNorm
+  std::cout << std::setprecision(nDigits + 1)
+            << "Integral value: " << round(val * formatNorm) / formatNorm
             << "+=" << args.Prec << std::endl;
 
   if (nDigits > 5) {
@@ -0,0 +1,68 @@
+#include <iomanip>
+
+#include "DistributedIntegration.hpp"
+#include "Task.hpp"
+
+int main(int argc, char** argv) try {
+  // Pool threads only compute, MPI is called from the main thread
+  int provided = MPI::Init_thread(argc, argv, MPI::THREAD_FUNNELED);
+  Defer _{[] { MPI::Finalize(); }};
+
+  if (provided < MPI::THREAD_FUNNELED)
+    throw std::runtime_error("MPI doesn't provide MPI_THREAD_FUNNELED");
+
+  int rank = MPI::COMM_WORLD.Get_rank();
+
+  if (argc < 2 || argc > 4) {
+    if (rank == 0)
+      std::cout << "Usage: mpirun -np <NRANKS> ./4-IntegrateMPI <NTHREADS> "
+                   "[RULE] [PLACEMENT]\n"
+                   "  RULE: midpoint, trapezoid, simpson, gauss1..gauss5 "
+                   "(default gauss3)\n"
+                   "  PLACEMENT: none (default), compact, scatter, CPU list"
+                << std::endl;
+    return 1;
+  }
+
+  size_t nThreads = std::stoul(argv[1]);
+  std::string method = argc > 2 ? argv[2] : "gauss3";
+
+  if (argc > 3)
+    WorkStealingPool::DefaultPlacement() = PlacementPolicy::Parse(argv[3]);
+
+  double nDigits = 10;
+  IntegrateArgs args = TaskArgs(nDigits);
+
+  // Grid depends on the method through StepEval
+  args.Id = "sin(1/x):" + method;
+  if (const char* cacheDir = getenv("GRID_CACHE_DIR"))
+    args.GridCacheDir = cacheDir;
+
+  double start = MPI::Wtime();
+  double val = 0;
+
+  auto withRule = [&]<QuadratureRule Rule>() {
+    args.StepEval = RuleStepEval<Rule>;
+    val = IntegrateDistributed<Rule>(args, FuncBatch{}, nThreads);
+  };
+
+  if (!VisitRule(method, withRule))
+    throw std::runtime_error("Unknown rule: " + method);
+
+  double elapsed = MPI::Wtime() - start;
+
+  if (rank != 0) return 0;
+
+  std::cout << std::setprecision(nDigits + 1) << "Integral value: " << val
+            << "+=" << args.Prec << std::endl;
+  std::cout << "Total time: " << elapsed * 1000 << "ms" << std::endl;
+
+  assert(fabs(RealVal - val) < 3e-6);
+  return 0;
+} catch (std::exception& e) {
+  std::cerr << "std::exception: " << e.what() << std::endl;
+  return 1;
+} catch (MPI::Exception& e) {
+  std::cerr << "MPI::Exception: " << e.Get_error_string() << std::endl;
+  return 1;
+}
@@ -0,0 +1,77 @@
+#include <iomanip>
+
+#include "DistributedIntegration.hpp"
+
+// Sobol' g-function: prod_d (|4 x_d - 2| + a_d) / (1 + a_d) with a_d = d,
+// its integral over the unit cube is 1 in any dimension
+struct GFunction {
+  size_t Dim;
+
+  void operator()(const double* const* coords, double* out, size_t n) const {
+#pragma omp simd
+    for (size_t i = 0; i < n; ++i) out[i] = 1;
+
+    for (size_t d = 0; d < Dim; ++d) {
+      const double* x = coords[d];
+      double a = d;
+
+#pragma omp simd
+      for (size_t i = 0; i < n; ++i)
+        out[i] *= (fabs(4 * x[i] - 2) + a) / (1 + a);
+    }
+  }
+};
+
+int main(int argc, char** argv) try {
+  // Pool threads only compute, MPI is called from the main thread
+  int provided = MPI::Init_thread(argc, argv, MPI::THREAD_FUNNELED);
+  Defer _{[] { MPI::Finalize(); }};
+
+  if (provided < MPI::THREAD_FUNNELED)
+    throw std::runtime_error("MPI doesn't provide MPI_THREAD_FUNNELED");
+
+  int rank = MPI::COMM_WORLD.Get_rank();
+
+  if (argc < 2 || argc > 5) {
+    if (rank == 0)
+      std::cout << "Usage: mpirun -np <NRANKS> ./4-IntegrateQMC <NTHREADS> "
+                   "[DIM] [LOG2_POINTS] [PLACEMENT]\n"
+                   "  DIM: 1.." << HaltonStream::MaxDim << " (default 8)\n"
+                   "  LOG2_POINTS: points per shift (default 20)\n"
+                   "  PLACEMENT: none (default), compact, scatter, CPU list"
+                << std::endl;
+    return 1;
+  }
+
+  size_t nThreads = std::stoul(argv[1]);
+  size_t dim = argc > 2 ? std::stoul(argv[2]) : 8;
+  size_t log2Points = argc > 3 ? std::stoul(argv[3]) : 20;
+
+  if (argc > 4)
+    WorkStealingPool::DefaultPlacement() = PlacementPolicy::Parse(argv[4]);
+
+  QmcBox box{std::vector<double>(dim, 0), std::vector<double>(dim, 1)};
+  QmcConfig config;
+  config.NPoints = uint64_t(1) << log2Points;
+
+  double start = MPI::Wtime();
+  auto res = IntegrateQmcDistributed(GFunction{dim}, box, config, nThreads);
+  double elapsed = MPI::Wtime() - start;
+
+  if (rank != 0) return 0;
+
+  std::cout << std::setprecision(10) << "Integral value: " << res.Value
+            << "+=" << res.Error << " (exact 1)" << std::endl;
+  std::cout << res.NEvals << " evaluations in " << elapsed * 1000 << "ms"
+            << std::endl;
+
+  // Far beyond the standard error unless the engine is broken
+  assert(fabs(res.Value - 1) < 10 * res.Error + 1e-12);
+  return 0;
+} catch (std::exception& e) {
+  std::cerr << "std::exception: " << e.what() << std::endl;
+  return 1;
+} catch (MPI::Exception& e) {
+  std::cerr << "MPI::Exception: " << e.Get_error_string() << std::endl;
+  return 1;
+}
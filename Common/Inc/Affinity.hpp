@@ -0,0 +1,199 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+static constexpr size_t CacheLineSize = 64;
+
+// Keeps per-worker values on separate cache lines
+template <typename T> struct alignas(CacheLineSize) Padded {
+  T Value{};
+};
+
+struct CpuInfo {
+  int Cpu;
+  int Package;
+  int Core;
+  int Node;
+};
+
+// CPUs available to the process with their place in the machine topology
+inline std::vector<CpuInfo> ReadTopology() {
+  namespace fs = std::filesystem;
+
+  auto readInt = [](const fs::path& path, int def) {
+    std::ifstream file(path);
+    int value = def;
+    return (file >> value) ? value : def;
+  };
+
+  cpu_set_t available;
+  CPU_ZERO(&available);
+  if (sched_getaffinity(0, sizeof(available), &available) != 0)
+    throw std::runtime_error(std::string("sched_getaffinity: ") +
+                             strerror(errno));
+
+  std::vector<CpuInfo> cpus;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &available)) continue;
+
+    fs::path dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    CpuInfo info{cpu, readInt(dir / "topology/physical_package_id", 0),
+                 readInt(dir / "topology/core_id", cpu), 0};
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+      std::string name = entry.path().filename();
+      if (name.rfind("node", 0) == 0 && name.size() > 4 &&
+          isdigit(name[4])) {
+        info.Node = std::stoi(name.substr(4));
+        break;
+      }
+    }
+
+    cpus.push_back(info);
+  }
+
+  return cpus;
+}
+
+// Maps worker index onto a CPU:
+//  - none:      threads are not pinned
+//  - compact:   fill one NUMA node / socket before moving to the next one
+//  - scatter:   round-robin over NUMA nodes / sockets
+//  - 0,2,4-7:   explicit CPU list, worker i gets i-th entry (modulo size)
+class PlacementPolicy final {
+ public:
+  enum class Kind { None, Compact, Scatter, List };
+
+ private:
+  Kind Type = Kind::None;
+  std::vector<int> Cpus;  // Worker i is pinned to Cpus[i % Cpus.size()]
+
+  static std::vector<int> ParseList(const std::string& str) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+
+    while (pos < str.size()) {
+      size_t next = str.find(',', pos);
+      if (next == std::string::npos) next = str.size();
+
+      std::string token = str.substr(pos, next - pos);
+      size_t dash = token.find('-');
+
+      int first = std::stoi(token.substr(0, dash));
+      int last = dash == std::string::npos ? first
+                                           : std::stoi(token.substr(dash + 1));
+      if (first < 0 || last < first)
+        throw std::invalid_argument("Bad CPU range: " + token);
+
+      for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+      pos = next + 1;
+    }
+
+    if (cpus.empty()) throw std::invalid_argument("Empty CPU list");
+    return cpus;
+  }
+
+  static std::vector<int> Order(Kind type) {
+    auto topology = ReadTopology();
+
+    auto compact = [](const CpuInfo& lhs, const CpuInfo& rhs) {
+      return std::tie(lhs.Node, lhs.Package, lhs.Core, lhs.Cpu) <
+             std::tie(rhs.Node, rhs.Package, rhs.Core, rhs.Cpu);
+    };
+    std::sort(topology.begin(), topology.end(), compact);
+
+    std::vector<int> cpus;
+    if (type == Kind::Compact) {
+      for (const auto& info : topology) cpus.push_back(info.Cpu);
+      return cpus;
+    }
+
+    // Scatter: take the k-th CPU of every domain before the (k+1)-th ones
+    std::map<std::pair<int, int>, std::vector<int>> domains;
+    for (const auto& info : topology)
+      domains[{info.Node, info.Package}].push_back(info.Cpu);
+
+    for (size_t k = 0; cpus.size() < topology.size(); ++k)
+      for (const auto& [_, domain] : domains)
+        if (k < domain.size()) cpus.push_back(domain[k]);
+
+    return cpus;
+  }
+
+ public:
+  PlacementPolicy() = default;
+
+  static PlacementPolicy Parse(const std::string& str) {
+    PlacementPolicy policy;
+
+    if (str.empty() || str == "none") return policy;
+
+    if (str == "compact")
+      policy.Type = Kind::Compact;
+    else if (str == "scatter")
+      policy.Type = Kind::Scatter;
+    else
+      policy.Type = Kind::List;
+
+    policy.Cpus =
+        policy.Type == Kind::List ? ParseList(str) : Order(policy.Type);
+    return policy;
+  }
+
+  Kind GetKind() const { return Type; }
+
+  // -1 if worker should not be pinned
+  int CpuFor(size_t worker) const {
+    if (Type == Kind::None || Cpus.empty()) return -1;
+    return Cpus[worker % Cpus.size()];
+  }
+
+  // Pins the calling thread
+  void Pin(size_t worker) const {
+    int cpu = CpuFor(worker);
+    if (cpu < 0) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0)
+      throw std::runtime_error("pthread_setaffinity_np(" +
+                               std::to_string(cpu) + "): " + strerror(ret));
+  }
+
+  // Sets the affinity of a thread created with attr
+  void Apply(pthread_attr_t* attr, size_t worker) const {
+    int cpu = CpuFor(worker);
+    if (cpu < 0) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int ret = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    if (ret != 0)
+      throw std::runtime_error("pthread_attr_setaffinity_np(" +
+                               std::to_string(cpu) + "): " + strerror(ret));
+  }
+
+  bool operator==(const PlacementPolicy& rhs) const {
+    return Type == rhs.Type && Cpus == rhs.Cpus;
+  }
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// In-process benchmarking: the body of a program is run Warmup +
+// Repetitions times, named phases inside it are timed with ScopedPhase and
+// summarized over the measured repetitions. Unlike timing the whole
+// process, neither the startup of the runtime nor MPI_Init is included
+struct BenchmarkConfig {
+  size_t Warmup = 0;
+  size_t Repetitions = 1;
+  std::string JsonPath;  // Results aren't written if empty
+
+  // BENCH_WARMUP, BENCH_REPS and BENCH_JSON override config, so that a
+  // driver script can control any target without new arguments
+  static BenchmarkConfig FromEnv(BenchmarkConfig config) {
+    if (const char* str = getenv("BENCH_WARMUP"))
+      config.Warmup = std::stoul(str);
+    if (const char* str = getenv("BENCH_REPS"))
+      config.Repetitions = std::stoul(str);
+    if (const char* str = getenv("BENCH_JSON")) config.JsonPath = str;
+
+    if (config.Repetitions == 0)
+      throw std::invalid_argument("BENCH_REPS should be non zero");
+    return config;
+  }
+
+  static BenchmarkConfig FromEnv() { return FromEnv(BenchmarkConfig{}); }
+};
+
+struct PhaseStats {
+  size_t N = 0;
+  double Min = 0;
+  double Median = 0;
+  double Mean = 0;
+  double Max = 0;
+  double Stddev = 0;  // Sample standard deviation
+};
+
+inline PhaseStats ComputePhaseStats(std::vector<double> samples) {
+  PhaseStats stats;
+  stats.N = samples.size();
+  if (samples.empty()) return stats;
+
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+
+  stats.Min = samples.front();
+  stats.Max = samples.back();
+  stats.Median = n % 2 ? samples[n / 2]
+                       : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+
+  double sum = 0;
+  for (double val : samples) sum += val;
+  stats.Mean = sum / n;
+
+  double sqsum = 0;
+  for (double val : samples) sqsum += (val - stats.Mean) * (val - stats.Mean);
+  stats.Stddev = n > 1 ? sqrt(sqsum / (n - 1)) : 0;
+
+  return stats;
+}
+
+class Benchmark final {
+ public:
+  // Turns a local phase time into the reported one, e.g. the maximum over
+  // the ranks. Called for every phase of every repetition in the same
+  // order on all ranks, so it may be collective. With Combine set all the
+  // phases should be declared before Run(), so that every rank has them
+  // even if it doesn't enter some
+  using CombineT = std::function<double(double)>;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Phase {
+    std::string Name;
+    double CurrentMs = 0;
+    std::vector<double> SamplesMs;
+  };
+
+  std::string Name;
+  BenchmarkConfig Config;
+  std::vector<std::pair<std::string, std::string>> Params;  // JSON values
+  std::vector<Phase> Phases;
+  CombineT Combine;
+  bool Writer = true;
+  bool Running = false;
+
+  size_t FindPhase(const std::string& name) {
+    for (size_t i = 0; i < Phases.size(); ++i)
+      if (Phases[i].Name == name) return i;
+
+    // A rank creating a phase the others don't have would mismatch the
+    // collectives of Combine
+    if (Running && Combine)
+      throw std::logic_error("Benchmark: phase " + name +
+                             " should be declared before Run()");
+
+    Phases.push_back(Phase{name, 0, {}});
+    return Phases.size() - 1;
+  }
+
+  static std::string Quote(const std::string& str) {
+    std::string res = "\"";
+    for (char c : str) {
+      if (c == '"' || c == '\\') res += '\\';
+      res += c;
+    }
+    return res + "\"";
+  }
+
+  static double MsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+  }
+
+ public:
+  class ScopedPhase final {
+   private:
+    Benchmark* Owner;
+    size_t Index;
+    Clock::time_point Start = Clock::now();
+
+   public:
+    ScopedPhase(Benchmark* owner, size_t index) : Owner{owner}, Index{index} {}
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+    // A phase entered several times per repetition accumulates
+    ~ScopedPhase() { Owner->Phases[Index].CurrentMs += MsSince(Start); }
+  };
+
+  Benchmark(const std::string& name, const BenchmarkConfig& config)
+      : Name{name}, Config{config} {}
+
+  const BenchmarkConfig& GetConfig() const { return Config; }
+
+  // Only the writer prints and stores results
+  void SetCombine(CombineT combine, bool writer) {
+    Combine = std::move(combine);
+    Writer = writer;
+  }
+
+  // Parameters of the run, e.g. number of workers or problem size
+  template <typename T>
+  void Param(const std::string& key, const T& value) {
+    std::ostringstream str;
+    if constexpr (std::is_arithmetic_v<T>) {
+      str << std::setprecision(17) << value;
+      Params.emplace_back(key, str.str());
+    } else {
+      str << value;
+      Params.emplace_back(key, Quote(str.str()));
+    }
+  }
+
+  // Creates the phase ahead of Run(), required with a Combine
+  void Declare(const std::string& phase) { FindPhase(phase); }
+
+  [[nodiscard]] ScopedPhase Time(const std::string& phase) {
+    return ScopedPhase(this, FindPhase(phase));
+  }
+
+  // Phase "total" is the whole body
+  template <typename F>
+  void Run(F&& body) {
+    size_t total = FindPhase("total");
+    Running = true;
+
+    for (size_t rep = 0; rep < Config.Warmup + Config.Repetitions; ++rep) {
+      for (auto& phase : Phases) phase.CurrentMs = 0;
+
+      auto start = Clock::now();
+      body();
+      Phases[total].CurrentMs = MsSince(start);
+
+      for (auto& phase : Phases) {
+        double ms = Combine ? Combine(phase.CurrentMs) : phase.CurrentMs;
+        if (rep >= Config.Warmup) phase.SamplesMs.push_back(ms);
+      }
+    }
+
+    Running = false;
+  }
+
+  PhaseStats Stats(const std::string& phase) const {
+    for (const auto& p : Phases)
+      if (p.Name == phase) return ComputePhaseStats(p.SamplesMs);
+    return {};
+  }
+
+  // Table of the phases, only if there is more than one repetition
+  void Report(std::ostream& out = std::cout) const {
+    if (!Writer || Config.Repetitions < 2) return;
+
+    out << std::left << std::setw(16) << "phase, ms" << std::right
+        << std::setw(12) << "median" << std::setw(12) << "min" << std::setw(12)
+        << "max" << std::setw(12) << "stddev" << std::endl;
+
+    for (const auto& phase : Phases) {
+      auto stats = ComputePhaseStats(phase.SamplesMs);
+      out << std::left << std::setw(16) << phase.Name << std::right
+          << std::setw(12) << stats.Median << std::setw(12) << stats.Min
+          << std::setw(12) << stats.Max << std::setw(12) << stats.Stddev
+          << std::endl;
+    }
+  }
+
+  void WriteJson(std::ostream& out) const {
+    out << std::setprecision(17) << "{\n  \"benchmark\": " << Quote(Name)
+        << ",\n  \"warmup\": " << Config.Warmup
+        << ",\n  \"repetitions\": " << Config.Repetitions
+        << ",\n  \"params\": {";
+
+    for (size_t i = 0; i < Params.size(); ++i)
+      out << (i ? ", " : "") << Quote(Params[i].first) << ": "
+          << Params[i].second;
+
+    out << "},\n  \"phases\": {";
+
+    for (size_t i = 0; i < Phases.size(); ++i) {
+      const auto& phase = Phases[i];
+      auto stats = ComputePhaseStats(phase.SamplesMs);
+
+      out << (i ? "," : "") << "\n    " << Quote(phase.Name)
+          << ": {\"median_ms\": " << stats.Median
+          << ", \"mean_ms\": " << stats.Mean << ", \"min_ms\": " << stats.Min
+          << ", \"max_ms\": " << stats.Max
+          << ", \"stddev_ms\": " << stats.Stddev << ", \"samples_ms\": [";
+
+      for (size_t j = 0; j < phase.SamplesMs.size(); ++j)
+        out << (j ? ", " : "") << phase.SamplesMs[j];
+      out << "]}";
+    }
+
+    out << "\n  }\n}\n";
+  }
+
+  // To Config.JsonPath if it is set
+  void WriteJson() const {
+    if (!Writer || Config.JsonPath.empty()) return;
+
+    std::ofstream out(Config.JsonPath);
+    WriteJson(out);
+    if (!out)
+      throw std::runtime_error("Failed to write " + Config.JsonPath);
+  }
+};
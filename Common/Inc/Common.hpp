@@ -1,9 +1,11 @@
 #pragma once
 
+#include <cstdio>
 #include <iostream>
 #include <mpi.h>
 #include <sstream>
 #include <stdexcept>
+#include <string>
 
 template <typename F> class Defer final {
 private:
@@ -35,27 +37,103 @@ public:
   }
 };
 
+// Levels below MPI_LOG_LEVEL (-DMPI_LOG_LEVEL=0 for everything) are compiled
+// out with the whole statement, operands included:
+//   MPI_LOG(log, Debug) << "payload " << payload << MPILogger::endl;
+enum class LogLevel { Debug, Info, Warn, Error, Off };
+
+#ifndef MPI_LOG_LEVEL
+#define MPI_LOG_LEVEL 1
+#endif
+
+static constexpr LogLevel MinLogLevel = static_cast<LogLevel>(MPI_LOG_LEVEL);
+
+#define MPI_LOG(log, level)                                                    \
+  if constexpr (LogLevel::level < MinLogLevel) {                               \
+  } else                                                                       \
+    (log).At<LogLevel::level>()
+
+inline const char *LogLevelName(LogLevel level) {
+  switch (level) {
+  case LogLevel::Debug:
+    return "debug";
+  case LogLevel::Info:
+    return "info";
+  case LogLevel::Warn:
+    return "warn";
+  case LogLevel::Error:
+    return "error";
+  case LogLevel::Off:
+    break;
+  }
+  return "?";
+}
+
+// How lines get to the file:
+//  - Buffered:  lines are appended to a local buffer, Flush() writes the
+//               buffers of all ranks collectively with Write_ordered, a rank
+//               whose buffer outgrows FlushBytes writes it with a single
+//               Write_shared. Leftovers are written on destruction
+//  - Immediate: every line is a Write_shared in atomic mode, nothing is lost
+//               if the process dies, but all ranks serialize on the shared
+//               file pointer
+enum class LogMode { Buffered, Immediate };
+
 class MPILogger final {
 private:
   MPI::File File;
   std::string User;
   std::stringstream Stream;
+  LogMode Mode;
+  size_t FlushBytes;
+  std::string Buffer;
+  double Start;
+  const char *Level = nullptr; // Of the line being written, if any
 
   static MPI::File MakeFile(const std::string &fname,
-                            const MPI::Intracomm &comm) {
+                            const MPI::Intracomm &comm, LogMode mode) {
     auto f = MPI::File::Open(comm, fname.c_str(),
                              MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI::INFO_NULL);
-    f.Set_atomicity(true);
+    f.Set_atomicity(mode == LogMode::Immediate);
     return f;
   }
 
+  void WriteShared() {
+    File.Write_shared(Buffer.data(), Buffer.size(), MPI::CHARACTER);
+    Buffer.clear();
+  }
+
 public:
   MPILogger(const std::string &fname, const std::string &user,
-            const MPI::Intracomm &comm = MPI::COMM_WORLD)
-      : User{user}, Stream{}, File{MakeFile(fname, comm)} {
+            const MPI::Intracomm &comm = MPI::COMM_WORLD,
+            LogMode mode = LogMode::Buffered, size_t flushBytes = 1 << 20)
+      : File{MakeFile(fname, comm, mode)}, User{user}, Stream{}, Mode{mode},
+        FlushBytes{flushBytes}, Start{MPI::Wtime()} {
     File.Set_size(0); // Truncate log file
+    Buffer.reserve(flushBytes);
   }
 
+  MPILogger(const MPILogger &) = delete;
+  MPILogger &operator=(const MPILogger &) = delete;
+
+  // Not collective: ranks may leave on different paths
+  ~MPILogger() noexcept {
+    try {
+      if (!Buffer.empty())
+        WriteShared();
+    } catch (MPI::Exception &e) {
+      std::cerr << "MPI Exception on log flush: " << e.Get_error_string()
+                << std::endl;
+    }
+  }
+
+  // Starts a line of the level, use MPI_LOG to compile out disabled ones
+  template <LogLevel L> MPILogger &At() {
+    Level = LogLevelName(L);
+    return *this;
+  }
+
+  // Lines without a level are never filtered
   template <typename T> MPILogger &operator<<(const T &rhs) {
     Stream << rhs;
     return *this;
@@ -65,12 +143,28 @@ public:
   static constexpr struct EndlT {
   } endl{};
 
+  // Line is prefixed with the user, seconds since construction and the
+  // level, if it has one
   MPILogger &operator<<(const EndlT &) {
-    std::string str = "[" + User + "]: ";
-    str += Stream.str() + "\n";
+    char stamp[48];
+    snprintf(stamp, sizeof(stamp), " +%.6fs%s%s]: ", MPI::Wtime() - Start,
+             Level ? " " : "", Level ? Level : "");
+
+    Buffer += "[" + User + stamp;
+    Buffer += Stream.str();
+    Buffer += "\n";
     Stream.str("");
-  
-    File.Write_shared(str.c_str(), str.size(), MPI::CHARACTER);
+    Level = nullptr;
+
+    if (Mode == LogMode::Immediate || Buffer.size() >= FlushBytes)
+      WriteShared();
     return *this;
   }
-};
\ No newline at end of file
+
+  // Collective over the communicator of the file: buffers are written in
+  // rank order. Call it off the timed path
+  void Flush() {
+    File.Write_ordered(Buffer.data(), Buffer.size(), MPI::CHARACTER);
+    Buffer.clear();
+  }
+};
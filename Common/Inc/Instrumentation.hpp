@@ -0,0 +1,461 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+inline timespec GetTimespec(clockid_t cid = CLOCK_MONOTONIC) {
+  timespec ts = {};
+  if (clock_gettime(cid, &ts) < 0)
+    throw std::runtime_error(std::string("clock_gettime: ") + strerror(errno));
+  return ts;
+}
+
+// ts2 >= ts1
+inline timespec GetTimeDiff(timespec ts1, timespec ts2) {
+  timespec tsd = {};
+  if (ts1.tv_sec > ts2.tv_sec ||
+      (ts1.tv_sec == ts2.tv_sec && ts1.tv_nsec > ts2.tv_nsec))
+    throw std::runtime_error("GetTimeDiff: wrong order");
+
+  tsd.tv_sec = ts2.tv_sec - ts1.tv_sec;
+  tsd.tv_nsec = ts2.tv_nsec - ts1.tv_nsec;
+
+  if (tsd.tv_nsec < 0) {
+    tsd.tv_sec--;
+    tsd.tv_nsec += 1000000000;
+  }
+
+  return tsd;
+}
+
+inline double Timespec2Ms(timespec ts) {
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Time stamp counter if it ticks at a constant rate through sleep states
+// (constant_tsc and nonstop_tsc), CLOCK_MONOTONIC nanoseconds otherwise.
+// Calibrated against CLOCK_MONOTONIC on the first call of NsPerTick()
+class TscClock final {
+ private:
+  static bool HasInvariantTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line))
+      if (line.rfind("flags", 0) == 0)
+        return line.find(" constant_tsc") != std::string::npos &&
+               line.find(" nonstop_tsc") != std::string::npos;
+#endif
+    return false;
+  }
+
+  static uint64_t MonotonicNs() {
+    timespec ts = GetTimespec(CLOCK_MONOTONIC);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+ public:
+  static bool UsesTsc() {
+    static const bool tsc = HasInvariantTsc();
+    return tsc;
+  }
+
+  static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (UsesTsc()) return __rdtsc();
+#endif
+    return MonotonicNs();
+  }
+
+  // Busy-waits 10ms on the first call
+  static double NsPerTick() {
+    static const double ratio = [] {
+      if (!UsesTsc()) return 1.0;
+
+      uint64_t ns0 = MonotonicNs();
+      uint64_t tick0 = Now();
+      while (MonotonicNs() - ns0 < 10000000) {
+      }
+      uint64_t ns1 = MonotonicNs();
+      uint64_t tick1 = Now();
+
+      return double(ns1 - ns0) / (tick1 - tick0);
+    }();
+    return ratio;
+  }
+};
+
+// Group of hardware counters of the calling thread, user space only. The
+// kernel may refuse any of them (perf_event_paranoid, virtual machines),
+// those read as zeros and Has() tells them apart
+class PerfCounters final {
+ public:
+  enum Counter { Cycles, Instructions, CacheMisses, BranchMisses, NCounters };
+
+  using Values = std::array<uint64_t, NCounters>;
+
+ private:
+  static constexpr uint64_t Configs[NCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+  int Leader = -1;
+  int Fds[NCounters] = {-1, -1, -1, -1};
+  std::vector<Counter> Order;  // Of the values in a group read
+
+  static int Open(uint64_t config, int group) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+  }
+
+ public:
+  PerfCounters() {
+    for (int i = 0; i < NCounters; ++i) {
+      int fd = Open(Configs[i], Leader);
+      if (fd < 0) {
+        if (Leader == -1) return;  // No group without cycles
+        continue;
+      }
+
+      if (Leader == -1) Leader = fd;
+      Fds[i] = fd;
+      Order.push_back(Counter(i));
+    }
+
+    ioctl(Leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(Leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  ~PerfCounters() {
+    for (int fd : Fds)
+      if (fd >= 0) close(fd);
+  }
+
+  bool Available() const { return Leader >= 0; }
+  bool Has(Counter counter) const { return Fds[counter] >= 0; }
+
+  Values Read() const {
+    Values res = {};
+    if (!Available()) return res;
+
+    // nr, time enabled, time running, values
+    uint64_t buf[3 + NCounters] = {};
+    if (read(Leader, buf, sizeof(buf)) < ssize_t(3 * sizeof(uint64_t)))
+      return res;
+
+    // The group is multiplexed with others when the PMU is oversubscribed,
+    // counts then cover only the running share of the time
+    uint64_t enabled = buf[1], running = buf[2];
+    double scale = running && running < enabled ? double(enabled) / running : 1;
+
+    for (size_t i = 0; i < Order.size() && i < buf[0]; ++i)
+      res[Order[i]] = buf[3 + i] * scale;
+    return res;
+  }
+};
+
+struct RegionStats {
+  uint64_t Calls = 0;
+  uint64_t Ticks = 0;
+  double Items = 0;  // Work units: evaluations, terms, cells
+  double Flops = 0;
+  double Bytes = 0;  // Loaded and stored, cache-resident buffers included
+  PerfCounters::Values Counters = {};
+
+  void Add(const RegionStats& rhs) {
+    Calls += rhs.Calls;
+    Ticks += rhs.Ticks;
+    Items += rhs.Items;
+    Flops += rhs.Flops;
+    Bytes += rhs.Bytes;
+    for (size_t i = 0; i < Counters.size(); ++i)
+      Counters[i] += rhs.Counters[i];
+  }
+};
+
+// Named regions timed per thread. Off unless enabled: a disabled
+// ScopedRegion is a relaxed load and a branch. Never destroyed, so threads
+// exiting during static destruction can still retire their stats
+class Instrumentation final {
+ public:
+  struct ThreadData {
+    size_t Index;
+    std::vector<RegionStats> Regions;
+    std::unique_ptr<PerfCounters> Counters;
+
+    explicit ThreadData(size_t index) : Index{index} {}
+  };
+
+ private:
+  std::atomic<bool> Enabled{false};
+  std::atomic<bool> CountersEnabled{false};
+  std::atomic<bool> CountersRefused{false};
+
+  std::mutex Mutex;
+  std::vector<std::string> Names;
+  std::vector<ThreadData*> Live;
+  std::vector<std::unique_ptr<ThreadData>> Retired;
+  size_t NThreads = 0;
+
+  // Registers the thread on construction, retires its stats on exit
+  struct LocalHandle {
+    ThreadData* Data;
+
+    LocalHandle() {
+      auto& inst = Get();
+      std::lock_guard<std::mutex> _(inst.Mutex);
+      Data = new ThreadData(inst.NThreads++);
+      inst.Live.push_back(Data);
+    }
+
+    ~LocalHandle() {
+      auto& inst = Get();
+      std::lock_guard<std::mutex> _(inst.Mutex);
+      std::erase(inst.Live, Data);
+      Data->Counters.reset();
+      inst.Retired.emplace_back(Data);
+    }
+  };
+
+ public:
+  static Instrumentation& Get() {
+    static auto* inst = new Instrumentation;
+    return *inst;
+  }
+
+  static ThreadData& Local() {
+    thread_local LocalHandle handle;
+    return *handle.Data;
+  }
+
+  bool IsEnabled() const { return Enabled.load(std::memory_order_relaxed); }
+  bool WithCounters() const {
+    return CountersEnabled.load(std::memory_order_relaxed);
+  }
+
+  void Enable(bool counters) {
+    TscClock::NsPerTick();  // Calibrate out of the regions
+    CountersEnabled.store(counters);
+    Enabled.store(true);
+  }
+
+  void Disable() { Enabled.store(false); }
+
+  void CountersUnavailable() {
+    CountersRefused.store(true, std::memory_order_relaxed);
+  }
+
+  // Call sites of the same name share the region, e.g. instantiations of
+  // a template
+  size_t Register(const std::string& name) {
+    std::lock_guard<std::mutex> _(Mutex);
+    auto it = std::find(Names.begin(), Names.end(), name);
+    if (it != Names.end()) return it - Names.begin();
+
+    Names.push_back(name);
+    return Names.size() - 1;
+  }
+
+  // Per region, total and per thread, with the derived rates. Threads
+  // should be idle: their stats are read without synchronization
+  void Report(std::ostream& out, const std::string& label) {
+    std::lock_guard<std::mutex> _(Mutex);
+
+    std::vector<const ThreadData*> threads(Live.begin(), Live.end());
+    for (const auto& data : Retired) threads.push_back(data.get());
+    std::sort(threads.begin(), threads.end(),
+              [](auto* lhs, auto* rhs) { return lhs->Index < rhs->Index; });
+
+    double nsPerTick = TscClock::NsPerTick();
+    auto line = [&](const std::string& name, const std::string& thread,
+                    const RegionStats& st) {
+      double ns = st.Ticks * nsPerTick;
+      auto ratio = [](double num, double den) {
+        return den > 0 ? num / den : 0;
+      };
+      const auto& c = st.Counters;
+
+      out << std::left << std::setw(12) << label << std::setw(24) << name
+          << std::setw(8) << thread << std::right << std::setw(10) << st.Calls
+          << std::setw(12) << ns / 1e6 << std::setw(12)
+          << ratio(ns, st.Items) << std::setw(8)
+          << ratio(c[PerfCounters::Instructions], c[PerfCounters::Cycles])
+          << std::setw(10) << ratio(c[PerfCounters::Cycles], st.Items)
+          << std::setw(10) << ratio(st.Flops, ns) << std::setw(10)
+          << ratio(st.Bytes, ns) << std::setw(10) << ratio(st.Bytes, st.Flops)
+          << std::setw(12)
+          << ratio(c[PerfCounters::CacheMisses] * 1e3, st.Items)
+          << std::setw(12)
+          << ratio(c[PerfCounters::BranchMisses] * 1e3, st.Items) << "\n";
+    };
+
+    out << std::left << std::setw(12) << "label" << std::setw(24) << "region"
+        << std::setw(8) << "thread" << std::right << std::setw(10) << "calls"
+        << std::setw(12) << "ms" << std::setw(12) << "ns/item"
+        << std::setw(8) << "IPC" << std::setw(10) << "cyc/item"
+        << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s"
+        << std::setw(10) << "B/flop" << std::setw(12) << "$miss/kitem"
+        << std::setw(12) << "brmiss/kit" << "\n";
+
+    if (CountersRefused.load())
+      out << label << ": hardware counters are unavailable, their columns "
+                      "are zeros\n";
+
+    for (size_t id = 0; id < Names.size(); ++id) {
+      RegionStats total;
+      size_t nThreads = 0;
+
+      for (auto* data : threads)
+        if (id < data->Regions.size() && data->Regions[id].Calls) {
+          total.Add(data->Regions[id]);
+          ++nThreads;
+        }
+
+      if (!total.Calls) continue;
+      line(Names[id], "all", total);
+
+      if (nThreads > 1)
+        for (auto* data : threads)
+          if (id < data->Regions.size() && data->Regions[id].Calls)
+            line(Names[id], "#" + std::to_string(data->Index),
+                 data->Regions[id]);
+    }
+  }
+};
+
+// Region id, registered once per call site:
+//   static const RegionHandle region{"IntegratePart"};
+//   ScopedRegion _(region, nEvals);
+struct RegionHandle {
+  size_t Id;
+  explicit RegionHandle(const std::string& name)
+      : Id{Instrumentation::Get().Register(name)} {}
+};
+
+class ScopedRegion final {
+ private:
+  Instrumentation::ThreadData* Data = nullptr;
+  size_t Id;
+  double Items, Flops, Bytes;
+  uint64_t Start;
+  PerfCounters::Values StartCounters;
+
+ public:
+  ScopedRegion(const RegionHandle& region, double items = 0, double flops = 0,
+               double bytes = 0)
+      : Id{region.Id}, Items{items}, Flops{flops}, Bytes{bytes} {
+    auto& inst = Instrumentation::Get();
+    if (!inst.IsEnabled()) return;
+
+    Data = &Instrumentation::Local();
+    if (Data->Regions.size() <= Id) Data->Regions.resize(Id + 1);
+
+    if (inst.WithCounters() && !Data->Counters) {
+      Data->Counters = std::make_unique<PerfCounters>();
+      if (!Data->Counters->Available()) inst.CountersUnavailable();
+    }
+    if (Data->Counters) StartCounters = Data->Counters->Read();
+
+    Start = TscClock::Now();
+  }
+
+  ScopedRegion(const ScopedRegion&) = delete;
+  ScopedRegion& operator=(const ScopedRegion&) = delete;
+
+  ~ScopedRegion() {
+    if (!Data) return;
+
+    uint64_t end = TscClock::Now();
+    auto& stats = Data->Regions[Id];
+
+    if (Data->Counters) {
+      auto counters = Data->Counters->Read();
+      // Scaled estimates of a multiplexed group may step back
+      for (size_t i = 0; i < counters.size(); ++i)
+        if (counters[i] > StartCounters[i])
+          stats.Counters[i] += counters[i] - StartCounters[i];
+    }
+
+    stats.Calls++;
+    stats.Ticks += end - Start;
+    stats.Items += Items;
+    stats.Flops += Flops;
+    stats.Bytes += Bytes;
+  }
+};
+
+// Enabled by $INSTRUMENT for the lifetime of the object, the report is
+// appended to the file it names ("-" for stderr) on destruction.
+// INSTRUMENT_COUNTERS=1 adds hardware counters. label tells ranks apart
+class ScopedInstrumentation final {
+ private:
+  std::string Path;
+  std::string Label;
+
+ public:
+  explicit ScopedInstrumentation(const std::string& label = "")
+      : Label{label} {
+    const char* path = getenv("INSTRUMENT");
+    if (!path) return;
+
+    const char* counters = getenv("INSTRUMENT_COUNTERS");
+    Path = path;
+    Instrumentation::Get().Enable(counters && std::string(counters) == "1");
+  }
+
+  ScopedInstrumentation(const ScopedInstrumentation&) = delete;
+  ScopedInstrumentation& operator=(const ScopedInstrumentation&) = delete;
+
+  ~ScopedInstrumentation() {
+    if (Path.empty()) return;
+
+    auto& inst = Instrumentation::Get();
+    inst.Disable();
+
+    std::ostringstream report;
+    inst.Report(report, Label.empty() ? "-" : Label);
+    std::string str = report.str();
+
+    // One append per report, so that the ones of the ranks don't interleave
+    FILE* file = Path == "-" ? stderr : fopen(Path.c_str(), "a");
+    if (!file) return;
+    fwrite(str.data(), 1, str.size(), file);
+    if (file != stderr) fclose(file);
+  }
+};
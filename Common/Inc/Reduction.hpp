@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reproducible reductions: the range [0, n) is cut into chunks of a fixed
+// size by the global index, every chunk is summed on its own and the chunk
+// partials are combined by a tree whose shape depends only on their count.
+// Which worker or rank computed a chunk doesn't matter, so the result is
+// bit-identical for any number of them
+struct ChunkedRange {
+  uint64_t Size;
+  uint64_t ChunkSize;
+
+  uint64_t NChunks() const { return (Size + ChunkSize - 1) / ChunkSize; }
+
+  uint64_t Begin(uint64_t chunk) const { return chunk * ChunkSize; }
+
+  uint64_t Count(uint64_t chunk) const {
+    uint64_t begin = Begin(chunk);
+    return begin + ChunkSize <= Size ? ChunkSize : Size - begin;
+  }
+
+  // Contiguous chunks [first, last) of worker w out of nWorkers
+  uint64_t FirstOf(uint64_t w, uint64_t nWorkers) const {
+    return NChunks() * w / nWorkers;
+  }
+};
+
+// Pairwise sum with the split points depending on n only
+inline double TreeReduce(const double* vals, size_t n) {
+  if (n <= 4) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += vals[i];
+    return sum;
+  }
+
+  size_t half = n / 2;
+  return TreeReduce(vals, half) + TreeReduce(vals + half, n - half);
+}
+
+inline double TreeReduce(const std::vector<double>& vals) {
+  return TreeReduce(vals.data(), vals.size());
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "Instrumentation.hpp"
+#include "Reduction.hpp"
+
+// Term n of a series, n >= 0 is passed as double so that the loop over
+// the indices vectorizes
+template <typename F>
+concept SeriesTerm = requires(const F& f, double n) {
+  { f(n) } -> std::convertible_to<double>;
+};
+
+struct SeriesTail {
+  double Value = 0;
+  double Error = 0;  // Bound of |Value - exact sum|
+};
+
+// Terms that know a closed-form estimate of sum_{n=from..to} f(n)
+template <typename F>
+concept TailEstimable = SeriesTerm<F> && requires(double from, double to) {
+  { F::Tail(from, to) } -> std::same_as<SeriesTail>;
+};
+
+// Neumaier summation: the rounding error of every addition is kept in Comp
+class CompensatedSum final {
+ private:
+  double Sum = 0;
+  double Comp = 0;
+
+ public:
+  void Add(double val) {
+    double t = Sum + val;
+    if (std::fabs(Sum) >= std::fabs(val))
+      Comp += (Sum - t) + val;
+    else
+      Comp += (val - t) + Sum;
+    Sum = t;
+  }
+
+  double Value() const { return Sum + Comp; }
+};
+
+static constexpr size_t SeriesNAccumulators = 8;
+static constexpr size_t SeriesBatchSize = 256;
+
+// sum_{n=offset..offset+count-1} term(n): terms of a batch are evaluated
+// with SIMD, then added to SeriesNAccumulators independent Kahan lanes, so
+// neither the divisions nor the additions form a single dependency chain.
+// Error is a few ulps of the sum of |terms| regardless of count
+template <SeriesTerm F>
+double SumSeries(const F& term, uint64_t offset, uint64_t count) {
+  constexpr size_t k = SeriesNAccumulators;
+
+  // 4 flops of the Kahan update, plus the term's own if it declares them.
+  // Every term is stored to vals and loaded back once
+  double termFlops = 0;
+  if constexpr (requires { F::Flops; }) termFlops = F::Flops;
+
+  static const RegionHandle region{"SumSeries"};
+  ScopedRegion _(region, count, count * (4 + termFlops),
+                 count * 2 * sizeof(double));
+
+  alignas(64) double vals[SeriesBatchSize];
+  double sum[k] = {};
+  double comp[k] = {};
+
+  for (uint64_t done = 0; done < count; done += SeriesBatchSize) {
+    int n = std::min<uint64_t>(SeriesBatchSize, count - done);
+    double base = offset + done;
+
+    // int index: the conversion to double vectorizes, uint64_t doesn't
+#pragma omp simd
+    for (int i = 0; i < n; ++i) vals[i] = term(base + i);
+
+    for (int i = n; i % k; ++i) vals[i] = 0;
+
+    for (int i = 0; i < n; i += k)
+#pragma omp simd
+      for (size_t j = 0; j < k; ++j) {
+        double y = vals[i + j] - comp[j];
+        double t = sum[j] + y;
+        comp[j] = (t - sum[j]) - y;
+        sum[j] = t;
+      }
+  }
+
+  CompensatedSum res;
+  for (size_t j = 0; j < k; ++j) {
+    res.Add(sum[j]);
+    res.Add(-comp[j]);
+  }
+
+  return res.Value();
+}
+
+// Chunk of the reproducible series sums, shared by every front-end so
+// that their results can be compared bit by bit
+static constexpr uint64_t SeriesChunkSize = 1 << 16;
+
+// out[c - first] = sum of the terms of chunk c, c in [first, last).
+// out holds last - first entries
+template <SeriesTerm F>
+void SumSeriesChunks(const F& term, const ChunkedRange& range, uint64_t first,
+                     uint64_t last, double* out) {
+  for (uint64_t c = first; c < last; ++c)
+    out[c - first] = SumSeries(term, range.Begin(c), range.Count(c));
+}
+
+// First nExact terms are summed directly, the rest of [0, count) comes from
+// the closed-form tail. Error bounds only the tail estimate
+template <TailEstimable F>
+SeriesTail SumSeriesWithTail(const F& term, uint64_t count, uint64_t nExact) {
+  if (nExact >= count) return {SumSeries(term, 0, count), 0};
+
+  auto tail = F::Tail(nExact, count - 1);
+  CompensatedSum res;
+  res.Add(SumSeries(term, 0, nExact));
+  res.Add(tail.Value);
+
+  return {res.Value(), tail.Error};
+}
+
+// 1 / (n + 1): partial sums are the harmonic numbers
+struct HarmonicTerm {
+  static constexpr double Flops = 2;
+
+  double operator()(double n) const { return 1 / (n + 1); }
+
+  // Euler-Maclaurin for sum_{k=a..b} 1/k with a = from + 1, b = to + 1,
+  // up to B6. The remainder is bounded by the first omitted B8 term
+  static SeriesTail Tail(double from, double to) {
+    double a = from + 1;
+    double b = to + 1;
+
+    auto diff = [a, b](int p) { return pow(a, -p) - pow(b, -p); };
+
+    double value = log(b / a) + (1 / a + 1 / b) / 2 + diff(2) / 12 -
+                   diff(4) / 120 + diff(6) / 252;
+    double error = diff(8) / 240 +
+                   4 * std::numeric_limits<double>::epsilon() * fabs(value);
+
+    return {value, error};
+  }
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Affinity.hpp"
+
+// Tracing from hot paths: every thread writes fixed-size binary records
+// into its own lock-free ring, a background thread drains the rings and
+// formats the records. A producer never waits: records that don't fit
+// into a full ring are dropped and counted
+
+struct TraceRecord {
+  uint64_t Ns;        // Since the creation of the TraceLog
+  uint32_t Thread;    // Producer, in the order of the first event
+  const char* Event;  // String literal, formatted by the drainer only
+  double Payload[2];
+};
+
+// Single-producer single-consumer ring
+class TraceRing final {
+ public:
+  static constexpr uint64_t Capacity = 1 << 14;
+
+ private:
+  static constexpr uint64_t Mask = Capacity - 1;
+
+  alignas(CacheLineSize) std::atomic<uint64_t> Head{0};  // Next to write
+  uint64_t CachedTail = 0;  // Producer's view of Tail, refreshed when full
+  std::atomic<uint64_t> Dropped{0};
+
+  alignas(CacheLineSize) std::atomic<uint64_t> Tail{0};  // Next to read
+
+  std::unique_ptr<TraceRecord[]> Records{new TraceRecord[Capacity]};
+
+ public:
+  // Producer side
+  bool Push(const TraceRecord& rec) {
+    uint64_t head = Head.load(std::memory_order_relaxed);
+
+    if (head - CachedTail == Capacity) {
+      CachedTail = Tail.load(std::memory_order_acquire);
+      if (head - CachedTail == Capacity) {
+        Dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+
+    Records[head & Mask] = rec;
+    Head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side
+  template <typename F>
+  size_t Drain(F&& consume) {
+    uint64_t tail = Tail.load(std::memory_order_relaxed);
+    uint64_t head = Head.load(std::memory_order_acquire);
+
+    for (uint64_t i = tail; i != head; ++i) consume(Records[i & Mask]);
+
+    Tail.store(head, std::memory_order_release);
+    return head - tail;
+  }
+
+  uint64_t NDropped() const { return Dropped.load(std::memory_order_relaxed); }
+};
+
+class TraceLog final {
+ public:
+  static constexpr size_t MaxThreads = 1024;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  std::ofstream File;
+  std::ostream* Out;
+
+  // Thread-local registrations are keyed by Id, not by address: a new log
+  // may reuse the address of a destroyed one
+  uint64_t Id;
+  Clock::time_point Start = Clock::now();
+
+  // Rings are allocated by their producers on the first event
+  std::unique_ptr<std::atomic<TraceRing*>[]> Rings{
+      new std::atomic<TraceRing*>[MaxThreads]()};
+  std::atomic<size_t> NThreads{0};
+
+  std::atomic<bool> Stop{false};
+  std::thread Drainer;
+
+  struct Registration {
+    uint64_t LogId = 0;
+    uint32_t Thread = 0;
+    TraceRing* Ring = nullptr;
+  };
+
+  static uint64_t NextId() {
+    static std::atomic<uint64_t> counter{0};
+    return ++counter;
+  }
+
+  Registration& Register() {
+    thread_local Registration local;
+    if (local.LogId == Id) return local;
+
+    size_t thread = NThreads.fetch_add(1, std::memory_order_relaxed);
+    if (thread >= MaxThreads)
+      throw std::runtime_error("TraceLog: too many threads");
+
+    local.LogId = Id;
+    local.Thread = thread;
+    local.Ring = new TraceRing;
+    Rings[thread].store(local.Ring, std::memory_order_release);
+    return local;
+  }
+
+  // Records of one pass are merged by time, passes are written in order
+  size_t DrainOnce(std::vector<TraceRecord>& batch) {
+    batch.clear();
+    size_t n = std::min(NThreads.load(std::memory_order_acquire), MaxThreads);
+
+    for (size_t i = 0; i < n; ++i)
+      if (auto* ring = Rings[i].load(std::memory_order_acquire))
+        ring->Drain([&](const TraceRecord& rec) { batch.push_back(rec); });
+
+    std::stable_sort(batch.begin(), batch.end(),
+                     [](const auto& lhs, const auto& rhs) {
+                       return lhs.Ns < rhs.Ns;
+                     });
+
+    char line[256];
+    for (const auto& rec : batch) {
+      int len = snprintf(line, sizeof(line), "+%.3fus T#%u %s %g %g\n",
+                         rec.Ns / 1e3, rec.Thread, rec.Event, rec.Payload[0],
+                         rec.Payload[1]);
+      Out->write(line, std::min<size_t>(len, sizeof(line) - 1));
+    }
+
+    return batch.size();
+  }
+
+  void DrainLoop() {
+    std::vector<TraceRecord> batch;
+    batch.reserve(TraceRing::Capacity);
+
+    while (!Stop.load(std::memory_order_acquire))
+      if (DrainOnce(batch) == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // Producers are done by now
+    while (DrainOnce(batch) != 0) {
+    }
+    Out->flush();
+  }
+
+ public:
+  explicit TraceLog(std::ostream& out)
+      : Out{&out}, Id{NextId()}, Drainer{[this] { DrainLoop(); }} {}
+
+  explicit TraceLog(const std::string& path)
+      : File{path}, Out{&File}, Id{NextId()} {
+    if (!File) throw std::runtime_error("TraceLog: can't open " + path);
+    Drainer = std::thread([this] { DrainLoop(); });
+  }
+
+  TraceLog(const TraceLog&) = delete;
+  TraceLog& operator=(const TraceLog&) = delete;
+
+  // Threads that emit events must be done before destruction
+  ~TraceLog() {
+    Stop.store(true, std::memory_order_release);
+    Drainer.join();
+
+    uint64_t dropped = 0;
+    for (size_t i = 0; i < std::min(NThreads.load(), MaxThreads); ++i)
+      if (auto* ring = Rings[i].load()) {
+        dropped += ring->NDropped();
+        delete ring;
+      }
+
+    if (dropped) *Out << "TraceLog: " << dropped << " records dropped\n";
+  }
+
+  // Wait-free after the first call in a thread
+  void Emit(const char* event, double a = 0, double b = 0) {
+    auto& reg = Register();
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      Clock::now() - Start)
+                      .count();
+    reg.Ring->Push({ns, reg.Thread, event, {a, b}});
+  }
+};
+
+// Target of TraceEvent, null when tracing is off
+inline std::atomic<TraceLog*> ActiveTrace{nullptr};
+
+// TraceEvent calls that may still use the ActiveTrace they have loaded
+inline std::atomic<size_t> TraceUsers{0};
+
+// A load and a branch when tracing is off. The acquire pairs with the
+// release of ScopedTrace, so that long-lived threads (e.g. pool workers)
+// see a fully constructed log
+inline void TraceEvent(const char* event, double a = 0, double b = 0) {
+  if (!ActiveTrace.load(std::memory_order_acquire)) return;
+
+  // Seq-cst with the reset in ~ScopedTrace: either the log is seen as
+  // null here, or the destructor sees this user and waits for it
+  TraceUsers.fetch_add(1);
+  if (auto* log = ActiveTrace.load()) log->Emit(event, a, b);
+  TraceUsers.fetch_sub(1);
+}
+
+// Activates tracing into the file named by environment variable envVar,
+// if it is set, for the lifetime of the object. Events emitted after the
+// destruction starts are dropped, the ones in progress are waited for
+class ScopedTrace final {
+ private:
+  std::unique_ptr<TraceLog> Log;
+
+ public:
+  explicit ScopedTrace(const char* envVar = "TRACE_LOG") {
+    if (const char* path = getenv(envVar)) {
+      Log = std::make_unique<TraceLog>(std::string(path));
+      ActiveTrace.store(Log.get(), std::memory_order_release);
+    }
+  }
+
+  // Unconditionally traces into out
+  explicit ScopedTrace(std::ostream& out)
+      : Log{std::make_unique<TraceLog>(out)} {
+    ActiveTrace.store(Log.get(), std::memory_order_release);
+  }
+
+  ScopedTrace(const ScopedTrace&) = delete;
+  ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+  ~ScopedTrace() {
+    if (!Log) return;
+
+    ActiveTrace.store(nullptr);
+    while (TraceUsers.load() != 0) std::this_thread::yield();
+  }
+};
@@ -0,0 +1,131 @@
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+# Strong- and weak-scaling sweeps over targets instrumented with
+# Common/Inc/Benchmark.hpp. Times come from the JSON the target writes to
+# $BENCH_JSON, so process and MPI startup are not included.
+#
+# CMD is a template, {p} is the number of workers, {n} the problem size:
+#   python3 scaling.py --size 1000000000 -- mpirun -np {p} ./1-SeriesSum {n}
+#   python3 scaling.py --mode weak --size 100000000 \
+#     -- mpirun -np {p} ./1-SeriesSum 1 repro {n}
+#   python3 scaling.py --max-workers 16 --save base.json -- ./4-Integrate {p}
+#   python3 scaling.py --baseline base.json -- ./4-Integrate {p}
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--mode", choices=["strong", "weak"], default="strong")
+parser.add_argument("--size", type=int, default=0,
+                    help="problem size, multiplied by p in weak mode")
+parser.add_argument("--max-workers", type=int, default=8)
+parser.add_argument("--reps", type=int, default=5)
+parser.add_argument("--warmup", type=int, default=1)
+parser.add_argument("--phase", default="compute",
+                    help="phase the speedup is computed for")
+parser.add_argument("--save", help="store results as a baseline")
+parser.add_argument("--baseline", help="compare with stored results")
+parser.add_argument("--threshold", type=float, default=0.1,
+                    help="relative slowdown reported as a regression")
+parser.add_argument("--plot", help="save speedup and efficiency plot")
+parser.add_argument("cmd", nargs=argparse.REMAINDER)
+args = parser.parse_args()
+
+cmd = args.cmd[1:] if args.cmd[:1] == ["--"] else args.cmd
+if not cmd:
+  parser.error("expected command template")
+
+workers = []
+p = 1
+while p <= args.max_workers:
+  workers.append(p)
+  p *= 2
+
+
+def run(p, n):
+  with tempfile.TemporaryDirectory() as tmp:
+    path = os.path.join(tmp, "bench.json")
+    env = dict(os.environ, BENCH_JSON=path, BENCH_REPS=str(args.reps),
+               BENCH_WARMUP=str(args.warmup))
+
+    argv = [arg.format(p=p, n=n) for arg in cmd]
+    # Open MPI doesn't forward the environment by default
+    if argv[0] == "mpirun":
+      argv[1:1] = [x for var in ("BENCH_JSON", "BENCH_REPS", "BENCH_WARMUP")
+                   for x in ("-x", var)]
+
+    print("Executing", " ".join(argv), file=sys.stderr)
+    subprocess.run(argv, env=env, check=True, stdout=subprocess.DEVNULL)
+
+    with open(path) as f:
+      return json.load(f)
+
+
+points = []
+for p in workers:
+  n = args.size * p if args.mode == "weak" else args.size
+  res = run(p, n)
+  phases = {name: stats["median_ms"] for name, stats in res["phases"].items()}
+  points.append({"p": p, "n": n, "phases": phases})
+
+t1 = points[0]["phases"][args.phase]
+print(f"{'p':>4} {args.phase + ', ms':>14} {'speedup':>9} {'efficiency':>11}")
+for point in points:
+  t = point["phases"][args.phase]
+  # Weak scaling: ideal time is constant, speedup is scaled by p
+  speedup = t1 / t * (point["p"] if args.mode == "weak" else 1)
+  point["speedup"] = speedup
+  point["efficiency"] = speedup / point["p"]
+  print(f"{point['p']:>4} {t:>14.3f} {speedup:>9.2f} "
+        f"{point['efficiency']:>11.2f}")
+
+results = {"mode": args.mode, "cmd": cmd, "size": args.size, "points": points}
+
+if args.save:
+  with open(args.save, "w") as f:
+    json.dump(results, f, indent=2)
+
+regressions = 0
+if args.baseline:
+  with open(args.baseline) as f:
+    base = json.load(f)
+  # Points are comparable only for the same workers and problem size
+  base_points = {(point["p"], point["n"]): point for point in base["points"]}
+
+  for point in points:
+    old = base_points.get((point["p"], point["n"]))
+    if not old:
+      continue
+    for name, t in point["phases"].items():
+      if name not in old["phases"] or old["phases"][name] <= 0:
+        continue
+      ratio = t / old["phases"][name]
+      mark = ""
+      if ratio > 1 + args.threshold:
+        mark = "  REGRESSION"
+        regressions += 1
+      print(f"p={point['p']:<4} {name:<16} {old['phases'][name]:>12.3f} -> "
+            f"{t:>12.3f} ms ({ratio - 1:+.1%}){mark}")
+
+if args.plot:
+  import matplotlib.pyplot as plt
+
+  p = [point["p"] for point in points]
+  fig, (sfig, efig) = plt.subplots(1, 2)
+  sfig.plot(p, [point["speedup"] for point in points], "o-")
+  sfig.plot(p, p, "--")
+  efig.plot(p, [point["efficiency"] for point in points], "o-")
+  efig.set_ylim(0, 1.5)
+
+  for ax, title in ((sfig, "Speedup"), (efig, "Efficiency")):
+    ax.set_xscale("log", base=2)
+    ax.set_xticks(p, list(map(str, p)))
+    ax.set_xlabel("p")
+    ax.set_title(f"{title} ({args.mode}, {args.phase})")
+    ax.grid()
+
+  plt.savefig(args.plot)
+
+sys.exit(1 if regressions else 0)